@@ -0,0 +1,190 @@
+#include "AssetPack.hpp"
+
+#include "read_write_chunk.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cassert>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+AssetPack::AssetPack(std::string const &filename_) : filename(filename_) {
+	//map the whole file into memory:
+	#if defined(_WIN32)
+	file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		file_handle = nullptr;
+		throw std::runtime_error("Failed to open asset pack '" + filename + "'.");
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size)) {
+		CloseHandle(file_handle);
+		throw std::runtime_error("Failed to get size of asset pack '" + filename + "'.");
+	}
+	mapped_size = size_t(file_size.QuadPart);
+	if (mapped_size != 0) {
+		mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping_handle) mapped = reinterpret_cast< char const * >(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+		if (!mapped) {
+			if (mapping_handle) CloseHandle(mapping_handle);
+			CloseHandle(file_handle);
+			throw std::runtime_error("Failed to map asset pack '" + filename + "'.");
+		}
+	}
+	#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open asset pack '" + filename + "'.");
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to stat asset pack '" + filename + "'.");
+	}
+	mapped_size = size_t(st.st_size);
+	if (mapped_size != 0) {
+		void *ptr = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map asset pack '" + filename + "'.");
+		}
+		mapped = reinterpret_cast< char const * >(ptr);
+	}
+	close(fd); //mapping stays valid after the descriptor is closed
+	#endif
+
+	try {
+		read_index();
+	} catch (...) {
+		unmap();
+		throw;
+	}
+}
+
+void AssetPack::read_index() {
+	//helper to walk the chunks in the mapped memory:
+	size_t at = 0;
+	auto next_chunk = [&](std::string const &magic, size_t *begin, size_t *end) {
+		struct ChunkHeader {
+			char magic[4];
+			uint32_t size;
+		};
+		static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+		ChunkHeader header;
+		if (mapped_size - at < sizeof(header)) {
+			throw std::runtime_error("Failed to read chunk header in asset pack '" + filename + "'.");
+		}
+		std::memcpy(&header, mapped + at, sizeof(header));
+		if (std::string(header.magic, 4) != magic) {
+			throw std::runtime_error("Unexpected magic number in asset pack '" + filename + "'.");
+		}
+		at += sizeof(header);
+		if (mapped_size - at < header.size) {
+			throw std::runtime_error("Truncated chunk in asset pack '" + filename + "'.");
+		}
+		*begin = at;
+		*end = at + header.size;
+		at = *end;
+	};
+
+	size_t names_begin, names_end;
+	next_chunk("str0", &names_begin, &names_end);
+
+	size_t index_begin, index_end;
+	next_chunk("idxP", &index_begin, &index_end);
+	if ((index_end - index_begin) % sizeof(IndexEntry) != 0) {
+		throw std::runtime_error("Size of index in asset pack '" + filename + "' not divisible by entry size.");
+	}
+
+	size_t data_begin, data_end;
+	next_chunk("dat0", &data_begin, &data_end);
+
+	if (at != mapped_size) {
+		std::cerr << "WARNING: trailing data in asset pack '" << filename << "'" << std::endl;
+	}
+
+	size_t names_size = names_end - names_begin;
+	size_t data_size = data_end - data_begin;
+	for (size_t e = index_begin; e < index_end; e += sizeof(IndexEntry)) {
+		IndexEntry entry;
+		std::memcpy(&entry, mapped + e, sizeof(entry));
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= names_size)) {
+			throw std::runtime_error("Invalid name indices in index of '" + filename + "'");
+		}
+		if (!(entry.data_begin <= entry.data_end && entry.data_end <= data_size)) {
+			throw std::runtime_error("Invalid data indices in index of '" + filename + "'");
+		}
+		std::string name(mapped + names_begin + entry.name_begin, mapped + names_begin + entry.name_end);
+		auto ret = index.emplace(name, std::make_pair(data_begin + entry.data_begin, data_begin + entry.data_end));
+		if (!ret.second) {
+			throw std::runtime_error("Duplicated file name '" + name + "' in '" + filename + "'");
+		}
+	}
+}
+
+AssetPack::~AssetPack() {
+	unmap();
+}
+
+void AssetPack::unmap() {
+	#if defined(_WIN32)
+	if (mapped) UnmapViewOfFile(mapped);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle) CloseHandle(file_handle);
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+	#else
+	if (mapped) munmap(const_cast< char * >(mapped), mapped_size);
+	#endif
+	mapped = nullptr;
+	mapped_size = 0;
+}
+
+bool AssetPack::find(std::string const &name, char const **data, size_t *size) const {
+	assert(data);
+	assert(size);
+	auto f = index.find(name);
+	if (f == index.end()) return false;
+	*data = mapped + f->second.first;
+	*size = f->second.second - f->second.first;
+	return true;
+}
+
+void write_asset_pack(std::string const &filename, std::vector< std::pair< std::string, std::vector< char > > > const &files) {
+	std::vector< char > names;
+	std::vector< AssetPack::IndexEntry > index;
+	std::vector< char > data;
+
+	for (auto const &file : files) {
+		if (names.size() + file.first.size() > 0xffffffffULL || data.size() + file.second.size() > 0xffffffffULL) {
+			throw std::runtime_error("Asset pack '" + filename + "' would be larger than 4GB.");
+		}
+		AssetPack::IndexEntry entry;
+		entry.name_begin = uint32_t(names.size());
+		names.insert(names.end(), file.first.begin(), file.first.end());
+		entry.name_end = uint32_t(names.size());
+
+		entry.data_begin = uint32_t(data.size());
+		data.insert(data.end(), file.second.begin(), file.second.end());
+		entry.data_end = uint32_t(data.size());
+
+		index.emplace_back(entry);
+	}
+
+	std::ofstream out(filename, std::ios::binary);
+	write_chunk("str0", names, &out);
+	write_chunk("idxP", index, &out);
+	write_chunk("dat0", data, &out);
+	if (!out) {
+		throw std::runtime_error("Failed to write asset pack '" + filename + "'.");
+	}
+}
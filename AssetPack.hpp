@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * An AssetPack is a single file holding many named data files.
+ * Packs are built by the 'pack-assets' tool and are memory-mapped when opened,
+ *  so looking up a file inside a pack doesn't open anything.
+ *
+ * Pack format (same chunk layout as read_write_chunk.hpp):
+ *  "str0" chunk: file names, concatenated
+ *  "idxP" chunk: array of IndexEntry (see below)
+ *  "dat0" chunk: file contents, concatenated
+ */
+
+struct AssetPack {
+	//Map a pack file into memory and read its index; throws on error:
+	AssetPack(std::string const &filename);
+	~AssetPack();
+
+	AssetPack(AssetPack const &) = delete;
+	AssetPack &operator=(AssetPack const &) = delete;
+
+	//Look up a file by name; returns false if the pack doesn't contain it:
+	// (*data stays valid as long as the pack exists)
+	bool find(std::string const &name, char const **data, size_t *size) const;
+
+	//index entries, as stored in the "idxP" chunk:
+	struct IndexEntry {
+		uint32_t name_begin, name_end;
+		uint32_t data_begin, data_end; //relative to the start of the "dat0" chunk's data
+	};
+	static_assert(sizeof(IndexEntry) == 16, "IndexEntry is packed.");
+
+	//internals:
+	std::string filename;
+	std::unordered_map< std::string, std::pair< size_t, size_t > > index; //name -> (begin, end) offsets into mapped memory
+	char const *mapped = nullptr;
+	size_t mapped_size = 0;
+	#if defined(_WIN32)
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+	#endif
+	void read_index(); //fills 'index' from the mapped chunks
+	void unmap();
+};
+
+//Write a pack containing the given (name, contents) pairs; throws on error:
+void write_asset_pack(std::string const &filename, std::vector< std::pair< std::string, std::vector< char > > > const &files);
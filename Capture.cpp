@@ -0,0 +1,200 @@
+#include "Capture.hpp"
+
+#include "load_save_png.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+
+Capture::Capture() {
+	encoder = std::thread(&Capture::encode_loop, this);
+}
+
+Capture::~Capture() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	encoder.join();
+}
+
+void Capture::screenshot(std::string const &filename) {
+	screenshot_filename = filename;
+}
+
+void Capture::start_sequence(std::string const &prefix, float rate) {
+	if (sequence) stop_sequence();
+	sequence = true;
+	sequence_prefix = prefix;
+	sequence_rate = std::max(0.001f, rate);
+	sequence_start = std::chrono::high_resolution_clock::now();
+	sequence_next = 0;
+	captured = 0;
+	dropped = 0;
+	std::cout << "Capturing frames to '" << prefix << "######.png' at " << sequence_rate << " fps." << std::endl;
+}
+
+void Capture::stop_sequence() {
+	if (!sequence) return;
+	sequence = false;
+	std::cout << "Stopped capture: " << captured << " frames captured, " << dropped << " dropped." << std::endl;
+}
+
+void Capture::frame(glm::uvec2 const &drawable_size) {
+	//hand any reads that have finished to the encoder:
+	collect(false);
+
+	if (!screenshot_filename.empty()) {
+		if (start_read(screenshot_filename, drawable_size)) {
+			std::cout << "Saving screenshot to '" << screenshot_filename << "'." << std::endl;
+		} else {
+			std::cout << "Screenshot to '" << screenshot_filename << "' dropped (capture busy)." << std::endl;
+			dropped += 1;
+		}
+		screenshot_filename.clear();
+	}
+
+	if (sequence) {
+		float elapsed = std::chrono::duration< float >(std::chrono::high_resolution_clock::now() - sequence_start).count();
+		uint64_t due = uint64_t(std::floor(elapsed * sequence_rate)); //latest frame number due
+		if (due >= sequence_next) {
+			//frames scheduled since the last capture that were never drawn:
+			dropped += uint32_t(due - sequence_next);
+
+			std::ostringstream filename;
+			filename << sequence_prefix << std::setw(6) << std::setfill('0') << due << ".png";
+			if (!start_read(filename.str(), drawable_size)) {
+				dropped += 1;
+			}
+			sequence_next = due + 1;
+		}
+	}
+}
+
+bool Capture::start_read(std::string const &filename, glm::uvec2 const &drawable_size) {
+	if (drawable_size.x == 0 || drawable_size.y == 0) return false;
+
+	Slot &slot = ring[ring_next];
+	if (slot.fence) return false; //every buffer is still waiting on the GPU
+
+	{ //don't pile up frames behind a slow encoder:
+		std::unique_lock< std::mutex > lock(mutex);
+		if (jobs.size() >= MaxBacklog) return false;
+	}
+
+	if (slot.buffer == 0) glGenBuffers(1, &slot.buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+	if (slot.size != drawable_size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, drawable_size.x * drawable_size.y * 4, nullptr, GL_STREAM_READ);
+		slot.size = drawable_size;
+	}
+
+	//read from the frame just drawn (the back buffer) into the buffer object; this returns without waiting:
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glReadBuffer(GL_BACK);
+	glReadPixels(0, 0, drawable_size.x, drawable_size.y, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.filename = filename;
+
+	ring_next = (ring_next + 1) % RingSize;
+	captured += 1;
+	return true;
+}
+
+void Capture::collect(bool wait) {
+	//reads finish in the order they were issued, so check from the oldest:
+	for (uint32_t i = 0; i < RingSize; ++i) {
+		Slot &slot = ring[(ring_next + i) % RingSize];
+		if (!slot.fence) continue;
+
+		GLenum status = glClientWaitSync(slot.fence, (wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0), (wait ? GL_TIMEOUT_IGNORED : 0));
+		if (status == GL_TIMEOUT_EXPIRED) break;
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+		if (status == GL_WAIT_FAILED) {
+			std::cerr << "Capture of '" << slot.filename << "' failed (fence wait failed)." << std::endl;
+			continue;
+		}
+
+		Job job;
+		job.filename = std::move(slot.filename);
+		job.size = slot.size;
+		{ //re-use storage from a previous frame if there is some:
+			std::unique_lock< std::mutex > lock(mutex);
+			if (!free_pixels.empty()) {
+				job.pixels = std::move(free_pixels.back());
+				free_pixels.pop_back();
+			}
+		}
+		job.pixels.resize(job.size.x * job.size.y);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		void const *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, job.pixels.size() * 4, GL_MAP_READ_BIT);
+		if (mapped) {
+			std::memcpy(job.pixels.data(), mapped, job.pixels.size() * 4);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (!mapped) {
+			std::cerr << "Capture of '" << job.filename << "' failed (could not map buffer)." << std::endl;
+			continue;
+		}
+
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			jobs.emplace_back(std::move(job));
+		}
+		wake.notify_one();
+	}
+}
+
+void Capture::finish() {
+	collect(true);
+
+	{ //wait for the encoder to empty its queue:
+		std::unique_lock< std::mutex > lock(mutex);
+		idle.wait(lock, [this](){ return jobs.empty() && !encoding; });
+	}
+
+	stop_sequence();
+
+	for (auto &slot : ring) {
+		if (slot.buffer) glDeleteBuffers(1, &slot.buffer);
+		slot = Slot();
+	}
+	ring_next = 0;
+}
+
+void Capture::encode_loop() {
+	//screenshots are for looking at, so favor speed over size (and ignore whatever alpha the framebuffer has):
+	PNGSaveOptions options = PNGSaveOptions::fast();
+	options.opaque = true;
+
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		wake.wait(lock, [this](){ return quit || !jobs.empty(); });
+		if (jobs.empty()) return; //only reached when quitting
+
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		encoding = true;
+		lock.unlock();
+
+		try {
+			save_png(job.filename, job.size, job.pixels.data(), LowerLeftOrigin, options);
+		} catch (std::exception const &e) {
+			std::cerr << "Failed to save '" << job.filename << "': " << e.what() << std::endl;
+		}
+
+		lock.lock();
+		free_pixels.emplace_back(std::move(job.pixels));
+		encoding = false;
+		if (jobs.empty()) idle.notify_all();
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Capture saves screenshots and numbered frame sequences without stalling the render loop:
+ *  - frames are read back into a ring of pixel buffer objects, with a fence per read;
+ *  - once a fence has passed (usually a frame or two later) the pixels are copied out
+ *    and handed to a background thread that encodes the PNG.
+ *
+ * Call Capture::frame() after drawing each frame (before swapping buffers),
+ *  and Capture::finish() before destroying the GL context.
+ */
+
+struct Capture {
+	Capture();
+	~Capture();
+
+	//save the next frame as 'filename':
+	void screenshot(std::string const &filename);
+
+	//save frames as 'prefix' + [6-digit frame number] + ".png" at 'rate' frames per second:
+	// (frame numbers follow the schedule, so dropped frames leave gaps in the numbering)
+	void start_sequence(std::string const &prefix, float rate = 30.0f);
+	void stop_sequence(); //prints a summary
+	bool sequence_running() const { return sequence; }
+
+	//read back the current (back buffer) frame if a capture is due, and pass finished reads to the encoder:
+	void frame(glm::uvec2 const &drawable_size);
+
+	//wait for all reads and encodes to complete and release GL objects:
+	void finish();
+
+	//counters (since start_sequence or construction):
+	uint32_t captured = 0; //frames read back and queued for encoding
+	uint32_t dropped = 0; //frames that were due but skipped (ring full, encoder backlog, or render slower than 'rate')
+
+	//internals:
+	static constexpr uint32_t RingSize = 3; //pixel buffer objects in flight
+	static constexpr uint32_t MaxBacklog = 8; //frames waiting for the encoder before new ones are dropped
+
+	struct Slot {
+		GLuint buffer = 0;
+		GLsync fence = 0; //non-zero while a read is in flight
+		glm::uvec2 size = glm::uvec2(0); //size of the buffer's storage
+		std::string filename;
+	};
+	Slot ring[RingSize];
+	uint32_t ring_next = 0; //next slot to read into (reads complete in the same order)
+
+	//pending single screenshot:
+	std::string screenshot_filename;
+
+	//sequence state:
+	bool sequence = false;
+	std::string sequence_prefix;
+	float sequence_rate = 30.0f;
+	std::chrono::high_resolution_clock::time_point sequence_start;
+	uint64_t sequence_next = 0; //next frame number due
+
+	//copies completed slots to the encoder; if 'wait' is set, blocks until all reads are done:
+	void collect(bool wait);
+	bool start_read(std::string const &filename, glm::uvec2 const &drawable_size);
+
+	//background encoder:
+	struct Job {
+		std::string filename;
+		glm::uvec2 size = glm::uvec2(0);
+		std::vector< glm::u8vec4 > pixels;
+	};
+	void encode_loop();
+	std::thread encoder;
+	std::mutex mutex; //protects everything below:
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::deque< Job > jobs;
+	std::vector< std::vector< glm::u8vec4 > > free_pixels; //recycled pixel storage
+	bool encoding = false; //encoder is working on a job
+	bool quit = false;
+};
@@ -128,20 +128,42 @@ if (maek.OS === 'windows') {
 // cppFile: name of c++ file to compile
 // objFileBase (optional): base name object file to produce (if not supplied, set to options.objDir + '/' + cppFile without the extension)
 //returns objFile: objFileBase + a platform-dependant suffix ('.o' or '.obj')
-const game_names = [
+//the audio system is shared by the game and the mix-bench tool:
+const sound_names = [
+	maek.CPP('Sound.cpp'),
+	maek.CPP('mix_kernels.cpp'),
+	maek.CPP('sample_codecs.cpp'),
+	maek.CPP('load_wav.cpp'),
+	maek.CPP('load_opus.cpp')
+];
+
+//walkmesh code is shared by the game and the walkmesh-bench tool:
+const walkmesh_names = [
 	maek.CPP('WalkMesh.cpp'),
+	maek.CPP('WalkPaths.cpp')
+];
+
+const game_names = [
+	...walkmesh_names,
 	maek.CPP('PlayMode.cpp'),
 	maek.CPP('main.cpp'),
+	maek.CPP('Capture.cpp'),
 	maek.CPP('LitColorTextureProgram.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
 	maek.CPP('VFXProgram.cpp'),
-	maek.CPP('Sound.cpp'),
-	maek.CPP('load_wav.cpp'),
-	maek.CPP('load_opus.cpp')
+	...sound_names
+];
+
+//asset pack reading/writing is shared by the game and the pack-assets tool:
+const asset_pack_names = [
+	maek.CPP('AssetPack.cpp')
 ];
 
 const common_names = [
+	...asset_pack_names,
 	maek.CPP('data_path.cpp'),
+	maek.CPP('data_files.cpp'),
+	maek.CPP('WorkerPool.cpp'),
 	maek.CPP('PathFont.cpp'),
 	maek.CPP('PathFont-font.cpp'),
 	maek.CPP('DrawLines.cpp'),
@@ -167,6 +189,22 @@ const show_scene_names = [
 	maek.CPP('ShowSceneMode.cpp')
 ];
 
+const pack_assets_names = [
+	maek.CPP('pack-assets.cpp')
+];
+
+const png_bench_names = [
+	maek.CPP('png-bench.cpp')
+];
+
+const mix_bench_names = [
+	maek.CPP('mix-bench.cpp')
+];
+
+const walkmesh_bench_names = [
+	maek.CPP('walkmesh-bench.cpp')
+];
+
 //the '[exeFile =] LINK(objFiles, exeFileBase, [, options])' links an array of objects into an executable:
 // objFiles: array of objects to link
 // exeFileBase: name of executable file to produce
@@ -174,9 +212,13 @@ const show_scene_names = [
 const game_exe = maek.LINK([...game_names, ...common_names], 'dist/game');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
+const pack_assets_exe = maek.LINK([...pack_assets_names, ...asset_pack_names], 'pack-assets');
+const png_bench_exe = maek.LINK([...png_bench_names, ...common_names], 'png-bench');
+const mix_bench_exe = maek.LINK([...mix_bench_names, ...sound_names, ...common_names], 'mix-bench');
+const walkmesh_bench_exe = maek.LINK([...walkmesh_bench_names, ...walkmesh_names, ...common_names], 'walkmesh-bench');
 
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, ...copies];
+maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, pack_assets_exe, png_bench_exe, mix_bench_exe, walkmesh_bench_exe, ...copies];
 
 //Note that tasks that produce ':abstract targets' are never cached.
 // This is similar to how .PHONY targets behave in make.
@@ -1,5 +1,6 @@
 #include "Mesh.hpp"
 #include "read_write_chunk.hpp"
+#include "data_files.hpp"
 
 #include <glm/glm.hpp>
 
@@ -14,7 +15,7 @@
 MeshBuffer::MeshBuffer(std::string const &filename) {
 	glGenBuffers(1, &buffer);
 
-	std::ifstream file(filename, std::ios::binary);
+	DataStream file(filename);
 
 	GLuint total = 0;
 
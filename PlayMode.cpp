@@ -23,16 +23,19 @@ Load< MeshBuffer > mountain_meshes(LoadTagDefault, []() -> MeshBuffer const * {
 	return ret;
 });
 
-Load< Scene::Texture > player_texture(LoadTagDefault, []() -> Scene::Texture const * {
-	return new Scene::Texture(data_path("player_texture.png"));
-});
-
-Load< Scene::Texture > mountain_texture(LoadTagDefault, []() -> Scene::Texture const * {
-	return new Scene::Texture(data_path("mountain_texture.png"));
-});
-
-Load< Scene::Texture > flame_texture(LoadTagDefault, []() -> Scene::Texture const * {
-	return new Scene::Texture(data_path("fire.png"));
+Scene::Texture const *player_texture = nullptr;
+Scene::Texture const *mountain_texture = nullptr;
+Scene::Texture const *flame_texture = nullptr;
+Load< void > textures(LoadTagDefault, [](){
+	//loaded together so that the images decode in parallel:
+	std::vector< Scene::Texture * > loaded = Scene::Texture::load_all({
+		data_path("player_texture.png"),
+		data_path("mountain_texture.png"),
+		data_path("fire.png")
+	});
+	player_texture = loaded[0];
+	mountain_texture = loaded[1];
+	flame_texture = loaded[2];
 });
 
 Load< Scene > mountain_scene(LoadTagDefault, []() -> Scene const * {
@@ -314,48 +317,8 @@ void PlayMode::update(float elapsed) {
 		}
 		
 
-		//using a for() instead of a while() here so that if walkpoint gets stuck in
-		// some awkward case, code will not infinite loop:
-		for (uint32_t iter = 0; iter < 10; ++iter) {
-			if (remain == glm::vec3(0.0f)) break;
-			WalkPoint end;
-			float time;
-			walkmesh->walk_in_triangle(player.at, remain, &end, &time);
-			player.at = end;
-			if (time == 1.0f) {
-				//finished within triangle:
-				remain = glm::vec3(0.0f);
-				break;
-			}
-			//some step remains:
-			remain *= (1.0f - time);
-			//try to step over edge:
-			glm::quat rotation;
-			if (walkmesh->cross_edge(player.at, &end, &rotation)) {
-				//stepped to a new triangle:
-				player.at = end;
-				//rotate step to follow surface:
-				remain = rotation * remain;
-			} else {
-				//ran into a wall, bounce / slide along it:
-				glm::vec3 const &a = walkmesh->vertices[player.at.indices.x];
-				glm::vec3 const &b = walkmesh->vertices[player.at.indices.y];
-				glm::vec3 const &c = walkmesh->vertices[player.at.indices.z];
-				glm::vec3 along = glm::normalize(b-a);
-				glm::vec3 normal = glm::normalize(glm::cross(b-a, c-a));
-				glm::vec3 in = glm::cross(normal, along);
-
-				//check how much 'remain' is pointing out of the triangle:
-				float d = glm::dot(remain, in);
-				if (d < 0.0f) {
-					//bounce off of the wall:
-					remain += (-1.25f * d) * in;
-				} else {
-					//if it's just pointing along the edge, bend slightly away from wall:
-					remain += 0.01f * d * in;
-				}
-			}
-		}
+		//walk (crossing edges and sliding along walls):
+		remain = walkmesh->walk(&player.at, remain);
 
 		constexpr float CameraRotateSpeed = 4.0f;
 		glm::quat target;
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstdint>
+#include <utility>
+
+/*
+ * SPSCQueue is a fixed-capacity, lock-free queue for passing values from
+ *  exactly one producer thread to exactly one consumer thread:
+ *
+ *  producer: if (!queue.push(std::move(value))) { ...full... }
+ *  consumer: while (queue.pop(&value)) { ... }
+ *
+ * Neither side ever blocks or allocates (storage is inline in the queue).
+ */
+
+template< typename T, uint32_t Capacity >
+struct SPSCQueue {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity should be a power of two.");
+
+	//producer side; returns false (and leaves 'value' alone) if the queue is full:
+	bool push(T &&value) {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+		slots[t & (Capacity - 1)] = std::move(value);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer side; returns false if the queue is empty:
+	bool pop(T *value_) {
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		*value_ = std::move(slots[h & (Capacity - 1)]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	//approximate (exact if called from either side while the other is idle):
+	uint32_t size() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	//internals:
+	std::array< T, Capacity > slots;
+	alignas(64) std::atomic< uint32_t > head{0}; //next slot to pop (written by consumer)
+	alignas(64) std::atomic< uint32_t > tail{0}; //next slot to push (written by producer)
+};
@@ -2,7 +2,9 @@
 
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
+#include "data_files.hpp"
 #include "load_save_png.hpp"
+#include "WorkerPool.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -261,7 +263,7 @@ void Scene::draw(std::list< AnimatedDrawable > const &to_draw, glm::mat4 const &
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 
-	std::ifstream file(filename, std::ios::binary);
+	DataStream file(filename);
 
 	std::vector< char > names;
 	read_chunk(file, "str0", &names);
@@ -486,3 +488,26 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 Scene::Texture::Texture(std::string const &filename) {
     load_png(filename, &size, &pixels, LowerLeftOrigin);
 }
+
+std::vector< Scene::Texture * > Scene::Texture::load_all(std::vector< std::string > const &filenames) {
+	std::vector< std::unique_ptr< Texture > > textures(filenames.size());
+	WorkerPool::shared().run(uint32_t(filenames.size()), [&](uint32_t i){
+		//each job reads (or finds in the asset pack) and decodes one image straight into its texture:
+		DataBlob blob = read_data_file(filenames[i]);
+		textures[i] = std::make_unique< Texture >();
+		PNGDecodeJob job;
+		job.png_data = blob.data;
+		job.png_size = blob.size;
+		job.size = peek_png_size(blob.data, blob.size);
+		textures[i]->size = job.size;
+		textures[i]->pixels.resize(job.size.x * job.size.y);
+		job.pixels = textures[i]->pixels.data();
+		decode_png(job, LowerLeftOrigin);
+	});
+	std::vector< Texture * > ret;
+	ret.reserve(textures.size());
+	for (auto &texture : textures) {
+		ret.emplace_back(texture.release());
+	}
+	return ret;
+}
@@ -136,7 +136,10 @@ struct Scene {
 
 	struct Texture {
 		Texture(std::string const &filename);
+		Texture() = default;
 		~Texture() {}
+		//load several textures at once (PNGs are decoded in parallel); throws on error:
+		static std::vector< Texture * > load_all(std::vector< std::string > const &filenames);
 		std::vector< glm::u8vec4 > pixels;
     	glm::uvec2 size = glm::vec2(0);
 	};
@@ -1,28 +1,422 @@
 #include "Sound.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "data_files.hpp"
+#include "mix_kernels.hpp"
+#include "sample_codecs.hpp"
+#include "SPSCQueue.hpp"
+#include "WorkerPool.hpp"
 
 #include <SDL.h>
+#include <opusfile.h>
 
-#include <list>
+#include <array>
+#include <limits>
 #include <cassert>
 #include <exception>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 //local (to this file) data used by the audio system:
 namespace {
 
 	//handy constants:
-	constexpr uint32_t const AUDIO_RATE = 48000; //sampling rate
-	constexpr uint32_t const MIX_SAMPLES = 1024; //number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+	constexpr uint32_t const SAMPLE_RATE = 48000; //sampling rate of Sample and Stream data
+
+	//mixer settings (set by Sound::init() or Sound::init_offline()):
+	uint32_t audio_rate = SAMPLE_RATE; //output sampling rate
+	uint32_t mix_samples = 1024; //number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+	float block_time = float(mix_samples) / float(audio_rate); //seconds per block (ramps advance this much per block)
+	bool cubic = true; //resampling quality
+	float source_step = 1.0f; //data values per output sample at rate 1 (SAMPLE_RATE / audio_rate)
+
+	//time spent in mix_block() (written by the mixing thread; read and reset by Sound::mix_cost()):
+	std::atomic< uint32_t > cost_blocks{0};
+	std::atomic< uint64_t > cost_total{0}; //nanoseconds
+	std::atomic< uint64_t > cost_peak{0}; //nanoseconds
+	std::array< std::atomic< uint64_t >, Sound::BusCount > cost_bus = {}; //nanoseconds (summed over threads)
+
+	//health counters (written by the mixing thread and device callback; read and reset by Sound::stats()):
+	// (peaks are kept by their only writer with load+store, so a peak that lands during stats() may be dropped or counted twice)
+	struct StatCounters {
+		std::atomic< uint32_t > blocks{0};
+		std::array< std::atomic< uint32_t >, Sound::Stats::LoadBins > load = {};
+		std::atomic< float > load_peak{0.0f};
+		std::atomic< uint32_t > overruns{0};
+		std::atomic< uint64_t > real_total{0}, virtual_total{0};
+		std::atomic< uint32_t > real_peak{0}, virtual_peak{0};
+		std::atomic< uint32_t > commands{0};
+		std::atomic< uint32_t > commands_peak{0};
+		std::atomic< uint32_t > dropped{0}; //(written by the game thread)
+		std::atomic< uint32_t > underruns{0};
+		std::atomic< uint32_t > xruns{0};
+		std::atomic< float > peak{0.0f};
+		std::atomic< uint32_t > clipped{0};
+	} stat;
+	std::chrono::steady_clock::time_point last_callback; //when the device callback last ran (callback only)
+	bool callback_started = false; //(callback only)
 
 	//The audio device:
 	SDL_AudioDeviceID device = 0;
+	//...or (for Sound::render()) none, but commands still go to the mixer:
+	bool offline = false;
+
+	//In premix mode, a thread mixes blocks into 'ring' ahead of time and the device callback just copies them out:
+	bool premix_enabled = false;
+	struct Premix {
+		std::thread thread;
+		std::atomic< bool > quit{false};
+		std::mutex mix_mutex; //held while mixing a block (so Sound::lock() still works)
+		std::vector< float > ring; //interleaved stereo
+		uint32_t frames = 0; //ring size in frames (a power of two)
+		uint32_t target = 0; //frames to keep mixed ahead (a multiple of mix_samples, at most 'frames')
+		std::atomic< uint64_t > written{0}; //frames mixed (premix thread)
+		std::atomic< uint64_t > read{0}; //frames copied to the device (callback)
+		std::atomic< uint32_t > underruns{0};
+	} premix;
+
+	//Voice holds the mixer's state for a playing sample (or stream); only touched by the audio callback:
+	struct Voice {
+		uint32_t slot = 0; //pool slot (what handles refer to)
+		uint32_t generation = 0;
+
+		//audio comes either from sample data in memory...
+		void const *data = nullptr; //(float, or encoded as 'format')
+		Sound::Sample::Format format = Sound::Sample::Format::Float32;
+		uint32_t data_size = 0; //in samples
+		uint32_t i = 0; //next data value to read
+		//...at 'rate' (times SAMPLE_RATE / audio_rate) data values per output sample; when resampling,
+		// playback is at i + frac, between data values i and i + 1:
+		float frac = 0.0f; //fraction of the way from data value i to i + 1
+		float previous = 0.0f; //data value i - 1 (the cubic's left neighbour; kept here since streams don't keep it)
+		//...or from a stream being decoded in the background (kept alive by the game thread's slot table):
+		Sound::StreamReader *stream = nullptr;
+
+		bool is_3D = false; //panned by 'position' relative to the listener (rather than by 'pan')?
+		bool loop = false; //should playback loop after data runs out?
+		bool stopping = false; //is playing stopping?
+		Sound::Bus bus = Sound::Bus::Effects;
+
+		//virtualization: only the loudest (volume x priority) voices are mixed; the rest just advance:
+		float priority = 1.0f;
+		bool real = true; //was the voice mixed (at full volume) at the end of the last block?
+		bool fresh = true; //hasn't been through a block yet (so doesn't need to fade in)
+
+		Sound::Ramp< float > volume = Sound::Ramp< float >(1.0f);
+		Sound::Ramp< float > pan = Sound::Ramp< float >(0.0f); //(2D only)
+		Sound::Ramp< glm::vec3 > position = Sound::Ramp< glm::vec3 >(0.0f); //(3D only)
+		Sound::Ramp< float > half_volume_radius = Sound::Ramp< float >(std::numeric_limits< float >::infinity()); //(3D only)
+		Sound::Ramp< float > rate = Sound::Ramp< float >(1.0f); //playback speed
+	};
+
+	//playing voices, packed densely at the start of 'voices' (only touched by the audio callback):
+	std::array< Voice, Sound::MaxVoices > voices;
+	uint32_t voice_count = 0;
+	constexpr uint32_t const NotPlaying = ~0U;
+	std::array< uint32_t, Sound::MaxVoices > voice_index = [](){ //slot -> index in 'voices' (or NotPlaying)
+		std::array< uint32_t, Sound::MaxVoices > ret;
+		ret.fill(NotPlaying);
+		return ret;
+	}();
+
+	//The game thread owns slot allocation: it takes slots from 'free' in play(), and
+	// puts them back once the audio callback reports (through 'retired') that the voice has finished.
+	// Anything the voice needed (like a stream decoder) is released then, on the game thread.
+	struct Slots {
+		Slots() {
+			free.reserve(Sound::MaxVoices);
+			for (uint32_t s = Sound::MaxVoices; s > 0; --s) {
+				free.emplace_back(s - 1);
+			}
+			generation.fill(0);
+			is_3D.fill(false);
+		}
+		std::vector< uint32_t > free;
+		std::array< uint32_t, Sound::MaxVoices > generation; //bumped each time the slot is reclaimed
+		std::array< bool, Sound::MaxVoices > is_3D;
+		std::array< std::shared_ptr< Sound::StreamReader >, Sound::MaxVoices > streams;
+	} slots;
+	SPSCQueue< uint32_t, Sound::MaxVoices > retired; //(can't overflow: at most MaxVoices slots are out)
+
+	//voice virtualization (audio callback only):
+	uint32_t max_real_voices = 64;
+	std::array< float, Sound::MaxVoices > audibility; //per-voice estimated loudness x priority for the current block
+	std::array< uint32_t, Sound::MaxVoices > ranked; //voice indices, loudest first (after partial sort)
+
+	//buses (audio callback only): each bus's voices are mixed in chunks of up to ChunkVoices voices
+	// (in parallel, if there is a mix_pool); the chunks are then summed in order, so the output
+	// is the same however many threads are mixing:
+	std::array< Sound::Ramp< float >, Sound::BusCount > bus_volume = [](){
+		std::array< Sound::Ramp< float >, Sound::BusCount > ret;
+		ret.fill(Sound::Ramp< float >(1.0f));
+		return ret;
+	}();
+	constexpr uint32_t const ChunkVoices = 64;
+	constexpr uint32_t const MaxChunks = Sound::MaxVoices / ChunkVoices + Sound::BusCount;
+	struct Chunk {
+		Sound::Bus bus;
+		uint32_t begin, end; //range of 'chunk_voices'
+	};
+	std::array< Chunk, MaxChunks > chunks;
+	uint32_t chunk_count = 0;
+	std::array< uint32_t, Sound::MaxVoices > chunk_voices; //voice indices, grouped by bus
+	std::vector< float > chunk_buffers; //MaxChunks x stereo block (sized by Sound::init())
+	std::array< uint64_t, MaxChunks > chunk_time; //nanoseconds spent mixing each chunk
+	//per-voice results of the current block:
+	std::array< float, Sound::MaxVoices > fade_start, fade_end; //(see mix_voice())
+	std::array< bool, Sound::MaxVoices > finished;
+	std::unique_ptr< WorkerPool > mix_pool; //(null when mixing on one thread)
+
+	//counts from the most recent block (written by the audio callback, read by anyone):
+	std::atomic< uint32_t > real_count{0};
+	std::atomic< uint32_t > virtual_count{0};
+
+	//The game thread never touches mixer state directly; instead it sends commands,
+	// which the audio callback applies (in order) at the start of each block:
+	struct Command {
+		enum Type : uint8_t {
+			Play, //start a voice in 'slot'
+			SetVolume, SetPan, SetPosition, SetHalfVolumeRadius, SetRate, SetBus, SetPriority, Stop, Seek, //change the voice in 'slot'
+			SetMasterVolume, SetBusVolume, SetListener, StopAll, SetMaxRealVoices //change global state
+		} type = Play;
+		uint32_t slot = 0;
+		uint32_t generation = 0; //commands for a voice that has since finished are ignored
+		//Play only:
+		void const *data = nullptr;
+		Sound::Sample::Format format = Sound::Sample::Format::Float32;
+		uint32_t data_size = 0;
+		Sound::StreamReader *stream = nullptr;
+		bool is_3D = false;
+		bool loop = false;
+		//parameters:
+		Sound::Bus bus = Sound::Bus::Effects;
+		glm::vec3 vec = glm::vec3(0.0f); //position (or listener position)
+		glm::vec3 vec2 = glm::vec3(0.0f); //listener right
+		float value = 0.0f; //volume, pan, radius, priority, or voice count
+		uint64_t sample = 0; //seek position (in samples; already wrapped or clamped for streams)
+		float value2 = 0.0f; //pan or radius (Play only)
+		float ramp = 0.0f;
+	};
+	//room for a Play and three changes to every voice between two blocks:
+	SPSCQueue< Command, 4 * Sound::MaxVoices > commands;
+
+	//send a command to the audio callback (call from the game thread only); never blocks or allocates,
+	// so if the queue is full the command is dropped (and counted in Sound::stats()):
+	bool send(Command const &command) {
+		if (device == 0 && !offline) return false; //no audio output, so nothing will ever read the queue
+		if (!commands.push(Command(command))) {
+			stat.dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	//take back slots of voices that have finished (game thread):
+	void reclaim() {
+		uint32_t slot;
+		while (retired.pop(&slot)) {
+			slots.generation[slot] += 1; //outstanding handles are now stale
+			slots.streams[slot].reset();
+			slots.free.emplace_back(slot);
+		}
+	}
+
+	//background thread that keeps playing streams decoded ahead of the mixer:
+	struct Streamer {
+		std::thread thread;
+		std::mutex mutex; //protects everything below:
+		std::condition_variable wake;
+		bool quit = false;
+		std::vector< std::shared_ptr< Sound::StreamReader > > readers;
+	} streamer;
+
+}
+
+//StreamReader decodes one playing copy of a Stream into a ring buffer:
+// - the streaming thread (producer) decodes into the ring and advances 'written';
+// - the audio callback (consumer) mixes from the ring and advances 'read'.
+//Positions are counted in samples since the start of playback (or the last seek) and never wrap, so
+// the ring index is (position & Mask) and the fill level is (written - read).
+//A seek is a handoff: the audio callback posts 'seek_request' and stops reading; the streaming thread
+// seeks, resets the ring, decodes from the new position, and then clears the request.
+struct Sound::StreamReader {
+	static constexpr uint32_t Capacity = 1 << 15; //~0.68s of audio
+	static constexpr uint32_t Mask = Capacity - 1;
+	static constexpr uint32_t MaxRead = 5760; //largest opus packet (120ms); decode in pieces no larger than this
+
+	StreamReader(Stream const &stream, bool loop);
+	~StreamReader();
+
+	//--- streaming thread side ---
+	void fill(); //handle any pending seek, then decode until the ring is full (or the stream ends)
+	void decode(bool seeking); //(helper for fill)
+
+	std::shared_ptr< DataBlob const > file; //keeps the compressed data alive
+	std::string filename;
+	uint64_t length = 0; //in samples
+	OggOpusFile *op = nullptr;
+	bool loop = false;
+	bool ended = false; //reached the end of a non-looping stream
+	std::vector< float > pcm; //stereo decode buffer
+
+	//--- audio callback side ---
+	//contiguous decoded samples ready to mix (at most 'count'), and advance past them once mixed:
+	uint32_t fetch(uint32_t count, float const **samples);
+	//copy up to 'count' decoded samples (across the ring's wrap-around) without advancing:
+	uint32_t peek(uint32_t count, float *samples);
+	void advance(uint32_t count);
+	bool finished() const; //no more audio will arrive
+
+	//--- shared ---
+	std::vector< float > ring;
+	std::atomic< uint64_t > written{0};
+	std::atomic< uint64_t > read{0};
+	std::atomic< int64_t > seek_request{-1}; //sample to seek to (set by the audio callback when it applies a Seek command), or -1
+	std::atomic< bool > at_end{false}; //set once the last sample has been written
+};
+
+Sound::StreamReader::StreamReader(Stream const &stream, bool loop_) : file(stream.file), filename(stream.filename), length(stream.length), loop(loop_), pcm(2 * MaxRead), ring(Capacity, 0.0f) {
+	int err = 0;
+	op = op_open_memory(reinterpret_cast< unsigned char const * >(file->data), file->size, &err);
+	if (err != 0) {
+		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
+	}
+}
+
+Sound::StreamReader::~StreamReader() {
+	if (op) op_free(op);
+}
 
-	//list of all currently playing samples:
-	std::list< std::shared_ptr< Sound::PlayingSample > > playing_samples;
+void Sound::StreamReader::fill() {
+	while (true) {
+		int64_t seek = seek_request.load(std::memory_order_acquire);
+		if (seek >= 0) {
+			int ret = op_pcm_seek(op, seek);
+			if (ret != 0) {
+				std::cerr << "opusfile error " << ret << " seeking in \"" << filename << "\"." << std::endl;
+			}
+			//the audio callback isn't reading while a seek is pending, so the ring can be reset from here:
+			ended = false;
+			at_end.store(false, std::memory_order_relaxed);
+			read.store(0, std::memory_order_relaxed);
+			written.store(0, std::memory_order_relaxed);
+		}
 
+		decode(seek >= 0);
+		if (ended) at_end.store(true, std::memory_order_release);
+
+		if (seek < 0) {
+			if (seek_request.load(std::memory_order_acquire) < 0) break;
+		} else if (seek_request.compare_exchange_strong(seek, -1, std::memory_order_acq_rel)) {
+			break; //(release: the reset ring is ready to read)
+		}
+		//...otherwise a seek arrived while decoding, so go around again to handle it.
+	}
+}
+
+void Sound::StreamReader::decode(bool seeking) {
+	while (!ended) {
+		//a seek makes anything decoded from here on stale, so leave it to the next pass:
+		if (!seeking && seek_request.load(std::memory_order_relaxed) >= 0) break;
+		uint64_t w = written.load(std::memory_order_relaxed);
+		uint64_t free = Capacity - (w - read.load(std::memory_order_acquire));
+		if (free == 0) break;
+		uint32_t count = uint32_t(std::min< uint64_t >(free, MaxRead));
+
+		int ret = op_read_float_stereo(op, pcm.data(), int(2 * count));
+		if (ret < 0) {
+			std::cerr << "opusfile read error " << ret << " reading \"" << filename << "\"; stopping stream." << std::endl;
+			ended = true;
+		} else if (ret == 0) {
+			if (loop) {
+				op_pcm_seek(op, 0);
+				continue;
+			}
+			ended = true;
+		} else {
+			for (uint32_t i = 0; i < uint32_t(ret); ++i) {
+				ring[(w + i) & Mask] = (pcm[2*i] + pcm[2*i+1]) * 0.5f; //downmix to mono by averaging
+			}
+			written.store(w + uint32_t(ret), std::memory_order_release);
+		}
+	}
+}
+
+uint32_t Sound::StreamReader::fetch(uint32_t count, float const **samples) {
+	if (seek_request.load(std::memory_order_acquire) >= 0) return 0; //(ring belongs to the streaming thread until the seek is done)
+	uint64_t r = read.load(std::memory_order_relaxed);
+	uint64_t available = written.load(std::memory_order_acquire) - r;
+	//don't run past the end of the ring's storage:
+	uint64_t contiguous = Capacity - (r & Mask);
+	*samples = ring.data() + (r & Mask);
+	return uint32_t(std::min< uint64_t >({ available, contiguous, count }));
+}
+
+uint32_t Sound::StreamReader::peek(uint32_t count, float *samples) {
+	if (seek_request.load(std::memory_order_acquire) >= 0) return 0;
+	uint64_t r = read.load(std::memory_order_relaxed);
+	uint32_t available = uint32_t(std::min< uint64_t >(written.load(std::memory_order_acquire) - r, count));
+	for (uint32_t done = 0; done < available; ) {
+		uint32_t at = uint32_t((r + done) & Mask);
+		uint32_t run = std::min(available - done, Capacity - at);
+		std::copy(ring.data() + at, ring.data() + at + run, samples + done);
+		done += run;
+	}
+	return available;
+}
+
+void Sound::StreamReader::advance(uint32_t count) {
+	read.store(read.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+bool Sound::StreamReader::finished() const {
+	//(a pending seek will bring more audio, even if the stream had ended)
+	if (seek_request.load(std::memory_order_acquire) >= 0) return false;
+	//(at_end is set after the final write, so check it first)
+	return at_end.load(std::memory_order_acquire)
+	    && read.load(std::memory_order_relaxed) >= written.load(std::memory_order_acquire);
+}
+
+//body of the streaming thread:
+static void stream_loop() {
+	std::vector< std::shared_ptr< Sound::StreamReader > > readers;
+	std::unique_lock< std::mutex > lock(streamer.mutex);
+	while (!streamer.quit) {
+		//forget about streams that are no longer playing (only the streamer holds a reference):
+		streamer.readers.erase(std::remove_if(streamer.readers.begin(), streamer.readers.end(), [](std::shared_ptr< Sound::StreamReader > const &reader){
+			return reader.use_count() == 1;
+		}), streamer.readers.end());
+		readers = streamer.readers;
+
+		lock.unlock();
+		for (auto &reader : readers) {
+			reader->fill();
+		}
+		readers.clear();
+		lock.lock();
+
+		//a 1024-sample mix block is ~21ms, so this keeps well ahead of the mixer:
+		streamer.wake.wait_for(lock, std::chrono::milliseconds(5));
+	}
+}
+
+//start a reader for 'stream' with some audio already decoded, and hand it to the streaming thread:
+static std::shared_ptr< Sound::StreamReader > start_stream(Sound::Stream const &stream, bool loop) {
+	auto reader = std::make_shared< Sound::StreamReader >(stream, loop);
+	reader->fill();
+
+	std::unique_lock< std::mutex > lock(streamer.mutex);
+	if (!streamer.thread.joinable()) {
+		streamer.quit = false;
+		streamer.thread = std::thread(stream_loop);
+	}
+	streamer.readers.emplace_back(reader);
+	return reader;
 }
 
 //public-facing data:
@@ -35,10 +429,33 @@ Sound::Listener Sound::listener;
 
 //This audio-mixing callback is defined below:
 void mix_audio(void *, Uint8 *buffer_, int len);
+//...as is the function that does the actual mixing:
+static void mix_block(float *buffer);
+//...and the body of the premix thread:
+static void premix_loop();
 
 //------------------------ public-facing --------------------------------
 
-Sound::Sample::Sample(std::string const &filename) {
+//convert a freshly-loaded sample's (float) 'data' to 'format':
+static void encode(Sound::Sample *sample_, Sound::Sample::Format format) {
+	assert(sample_);
+	auto &sample = *sample_;
+	if (sample.data.size() > std::numeric_limits< uint32_t >::max()) {
+		throw std::runtime_error("Sample is too long (" + std::to_string(sample.data.size()) + " samples).");
+	}
+	sample.length = uint32_t(sample.data.size());
+	sample.format = format;
+	if (format == Sound::Sample::Format::Int16) {
+		encode_int16(sample.data.data(), sample.length, &sample.packed);
+	} else if (format == Sound::Sample::Format::ADPCM) {
+		encode_adpcm(sample.data.data(), sample.length, &sample.packed);
+	}
+	if (format != Sound::Sample::Format::Float32) {
+		sample.data = std::vector< float >(); //(release the memory, not just the contents)
+	}
+}
+
+Sound::Sample::Sample(std::string const &filename, Format format_) {
 	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
 		load_wav(filename, &data);
 	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
@@ -46,14 +463,70 @@ Sound::Sample::Sample(std::string const &filename) {
 	} else {
 		throw std::runtime_error("Sample '" + filename + "' doesn't end in either \".png\" or \".opus\" -- unsure how to load.");
 	}
+	encode(this, format_);
+}
+
+Sound::Sample::Sample(std::vector< float > const &data_, Format format_) : data(data_) {
+	encode(this, format_);
 }
 
-Sound::Sample::Sample(std::vector< float > const &data_) : data(data_) {
+Sound::Stream::Stream(std::string const &filename_) : filename(filename_) {
+	if (!(filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus")) {
+		throw std::runtime_error("Stream '" + filename + "' doesn't end in \".opus\" -- only opus files can be streamed.");
+	}
+	file = std::make_shared< DataBlob >(read_data_file(filename));
+
+	//check that the file is readable and find its length:
+	int err = 0;
+	std::unique_ptr< OggOpusFile, decltype(&op_free) > op(
+		op_open_memory(reinterpret_cast< unsigned char const * >(file->data), file->size, &err),
+		op_free
+	);
+	if (err != 0) {
+		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
+	}
+	ogg_int64_t total = op_pcm_total(op.get(), -1);
+	if (total <= 0) {
+		throw std::runtime_error("Stream '" + filename + "' contains no audio.");
+	}
+	length = uint64_t(total);
 }
 
 
 
-void Sound::init() {
+//check and apply block size + rate from 'settings':
+static void use_settings(Sound::Settings const &settings) {
+	uint32_t size = settings.block_size;
+	if (size < 128 || size > 8192 || (size & (size - 1)) != 0) {
+		throw std::runtime_error("Sound block size should be a power of two between 128 and 8192 (not " + std::to_string(size) + ").");
+	}
+	if (settings.rate < 8000 || settings.rate > 192000) {
+		throw std::runtime_error("Sound rate should be between 8000 and 192000 Hz (not " + std::to_string(settings.rate) + ").");
+	}
+	audio_rate = settings.rate;
+	cubic = settings.cubic;
+	source_step = float(SAMPLE_RATE) / float(audio_rate);
+	mix_samples = size;
+	block_time = float(mix_samples) / float(audio_rate);
+	cost_blocks = 0;
+	cost_total = 0;
+	cost_peak = 0;
+	for (auto &cost : cost_bus) cost = 0;
+	Sound::stats(); //(resets the counters)
+	callback_started = false;
+
+	chunk_buffers.assign(size_t(MaxChunks) * 2 * mix_samples, 0.0f);
+	mix_pool.reset();
+}
+
+//start the worker threads for mixing (once there is something to mix for):
+static void start_mix_pool(Sound::Settings const &settings) {
+	if (settings.mix_threads != 1) mix_pool = std::make_unique< WorkerPool >(settings.mix_threads);
+}
+
+void Sound::init(Settings const &settings) {
+	use_settings(settings);
+
 	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
 		std::cerr << "Failed to initialize SDL audio subsytem:\n" << SDL_GetError() << std::endl;
 		std::cerr << "  (Will continue without audio.)\n" << std::endl;
@@ -63,151 +536,432 @@ void Sound::init() {
 	//Based on the example on https://wiki.libsdl.org/SDL_OpenAudioDevice
 	SDL_AudioSpec want, have;
 	SDL_zero(want);
-	want.freq = AUDIO_RATE;
+	want.freq = audio_rate;
 	want.format = AUDIO_F32SYS;
 	want.channels = 2;
-	want.samples = MIX_SAMPLES;
+	want.samples = uint16_t(mix_samples);
 	want.callback = mix_audio;
 
-	device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+	//mixing on several threads means waiting on the worker pool, which mustn't happen in the device callback,
+	// so it always goes with premix:
+	bool use_premix = settings.premix || settings.mix_threads != 1;
+
+	//with premix, the callback just copies, so it can take any buffer size:
+	device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, (use_premix ? SDL_AUDIO_ALLOW_SAMPLES_CHANGE : 0));
 	if (device == 0) {
 		std::cerr << "Failed to open audio device:\n" << SDL_GetError() << std::endl;
 		std::cerr << "  (Will continue without audio.)\n" << std::endl;
-	} else {
-		//start audio playback:
-		SDL_PauseAudioDevice(device, 0);
-		std::cout << "Audio output initialized." << std::endl;
+		return;
+	}
+
+	start_mix_pool(settings);
+
+	if (use_premix) {
+		//round the latency target up to whole blocks, and the ring up to a power of two:
+		uint32_t blocks = std::max(1U, uint32_t(std::ceil(settings.premix_latency * audio_rate / mix_samples)));
+		//the device may have picked a larger buffer than asked for; every callback needs that much ready, so keep at least that many (whole) blocks mixed ahead:
+		uint32_t device_blocks = (uint32_t(have.samples) + mix_samples - 1) / mix_samples;
+		blocks = std::max(blocks, device_blocks);
+		premix.target = blocks * mix_samples;
+		premix.frames = mix_samples;
+		while (premix.frames < premix.target) premix.frames *= 2;
+		premix.ring.assign(2 * premix.frames, 0.0f);
+		premix.written = 0;
+		premix.read = 0;
+		premix.underruns = 0;
+		premix.quit = false;
+		premix_enabled = true;
+		premix.thread = std::thread(premix_loop);
+	}
+
+	//start audio playback:
+	SDL_PauseAudioDevice(device, 0);
+	std::cout << "Audio output initialized (" << audio_rate << " Hz, " << mix_samples << "-sample blocks";
+	if (use_premix) std::cout << ", " << have.samples << "-sample device buffer, mixing " << (1000.0f * premix.target / audio_rate) << "ms ahead";
+	std::cout << ")";
+	std::cout << "." << std::endl;
+}
+
+Sound::PremixStatus Sound::premix_status() {
+	PremixStatus status;
+	if (!premix_enabled) return status;
+	uint64_t buffered = premix.written.load(std::memory_order_acquire) - premix.read.load(std::memory_order_acquire);
+	status.buffered = float(buffered) / float(audio_rate);
+	status.capacity = float(premix.target) / float(audio_rate);
+	status.underruns = premix.underruns.load(std::memory_order_relaxed);
+	return status;
+}
+
+
+Sound::MixCost Sound::mix_cost() {
+	MixCost cost;
+	cost.blocks = cost_blocks.exchange(0);
+	uint64_t total = cost_total.exchange(0);
+	uint64_t peak = cost_peak.exchange(0);
+	if (cost.blocks != 0) cost.average = float(double(total) * 1e-9 / cost.blocks);
+	cost.peak = float(double(peak) * 1e-9);
+	cost.budget = block_time;
+	for (uint32_t b = 0; b < BusCount; ++b) {
+		uint64_t bus = cost_bus[b].exchange(0);
+		if (cost.blocks != 0) cost.bus[b] = float(double(bus) * 1e-9 / cost.blocks);
+	}
+	return cost;
+}
+
+Sound::Stats Sound::stats() {
+	Stats stats;
+	stats.blocks = stat.blocks.exchange(0);
+	for (uint32_t i = 0; i < Stats::LoadBins; ++i) {
+		stats.load[i] = stat.load[i].exchange(0);
+	}
+	stats.load_peak = stat.load_peak.exchange(0.0f);
+	stats.overruns = stat.overruns.exchange(0);
+	uint64_t real_total = stat.real_total.exchange(0);
+	uint64_t virtual_total = stat.virtual_total.exchange(0);
+	if (stats.blocks != 0) {
+		stats.real_average = float(double(real_total) / stats.blocks);
+		stats.virtual_average = float(double(virtual_total) / stats.blocks);
+	}
+	stats.real_peak = stat.real_peak.exchange(0);
+	stats.virtual_peak = stat.virtual_peak.exchange(0);
+	stats.commands = stat.commands.exchange(0);
+	stats.commands_peak = stat.commands_peak.exchange(0);
+	stats.dropped_commands = stat.dropped.exchange(0);
+	stats.underruns = stat.underruns.exchange(0);
+	stats.xruns = stat.xruns.exchange(0);
+	stats.peak = stat.peak.exchange(0.0f);
+	stats.clipped = stat.clipped.exchange(0);
+	return stats;
+}
+
+std::ostream &Sound::operator<<(std::ostream &out, Stats const &stats) {
+	out << "Audio: " << stats.blocks << " blocks; load";
+	for (uint32_t i = 0; i < Stats::LoadBins; ++i) {
+		if (i + 1 < Stats::LoadBins) out << " <" << (100.0f * Stats::LoadEdges[i]) << "%:";
+		else out << " >=" << (100.0f * Stats::LoadEdges[i-1]) << "%:";
+		out << stats.load[i];
+	}
+	out << ", peak " << int(100.0f * stats.load_peak) << "% (" << stats.overruns << " over budget); "
+	    << "voices " << stats.real_average << " real (peak " << stats.real_peak << "), "
+	    << stats.virtual_average << " virtual (peak " << stats.virtual_peak << "); "
+	    << stats.commands << " commands (peak " << stats.commands_peak << " per block, " << stats.dropped_commands << " dropped); "
+	    << stats.underruns << " underruns, " << stats.xruns << " xruns; "
+	    << "output peak " << stats.peak << " (" << stats.clipped << " clipped).";
+	return out;
+}
+
+void Sound::init_offline(Settings const &settings) {
+	use_settings(settings);
+	start_mix_pool(settings);
+	offline = true;
+}
+
+void Sound::render(float *buffer, uint32_t frames) {
+	if (!offline) {
+		throw std::runtime_error("Sound::render() needs Sound::init_offline() first.");
+	}
+	if (frames % mix_samples != 0) {
+		throw std::runtime_error("Sound::render() called with " + std::to_string(frames) + " frames, which isn't a multiple of the block size (" + std::to_string(mix_samples) + ").");
+	}
+	for (uint32_t f = 0; f < frames; f += mix_samples) {
+		mix_block(buffer + 2 * f);
 	}
 }
 
+uint32_t Sound::block_size() {
+	return mix_samples;
+}
 
 void Sound::shutdown() {
+	offline = false;
 	if (device != 0) {
+		//report how expensive mixing was:
+		MixCost cost = mix_cost();
+		if (cost.blocks != 0) {
+			std::cout << "Audio mixed " << cost.blocks << " blocks of " << mix_samples << " samples; "
+			          << (1e3f * cost.average) << "ms average, " << (1e3f * cost.peak) << "ms peak (" << (1e3f * cost.budget) << "ms budget); "
+			          << "per bus: " << (1e3f * cost.bus[0]) << "ms effects, " << (1e3f * cost.bus[1]) << "ms ambience, " << (1e3f * cost.bus[2]) << "ms music." << std::endl;
+			std::cout << stats() << std::endl;
+		}
+
 		//stop audio playback:
 		SDL_PauseAudioDevice(device, 1);
 		SDL_CloseAudioDevice(device);
 		device = 0;
 	}
+
+	if (premix_enabled) {
+		premix.quit = true;
+		premix.thread.join();
+		premix_enabled = false;
+	}
+
+	if (streamer.thread.joinable()) {
+		{ //stop streaming:
+			std::unique_lock< std::mutex > lock(streamer.mutex);
+			streamer.quit = true;
+		}
+		streamer.wake.notify_all();
+		streamer.thread.join();
+		streamer.readers.clear();
+	}
+
+	mix_pool.reset();
 }
 
 
 void Sound::lock() {
-	if (device) SDL_LockAudioDevice(device);
+	if (premix_enabled) premix.mix_mutex.lock();
+	else if (device) SDL_LockAudioDevice(device);
 }
 
 void Sound::unlock() {
-	if (device) SDL_UnlockAudioDevice(device);
+	if (premix_enabled) premix.mix_mutex.unlock();
+	else if (device) SDL_UnlockAudioDevice(device);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+//start a new voice (all of the play/loop functions end up here):
+static Sound::PlayingSample start(Command command, std::shared_ptr< Sound::StreamReader > const &stream) {
+	reclaim();
+	Sound::PlayingSample handle;
+	//without audio output (or if every voice is busy) there's nothing to do; return a stopped handle:
+	if ((device == 0 && !offline) || slots.free.empty()) return handle;
+	handle.slot = slots.free.back();
+	slots.free.pop_back();
+	handle.generation = slots.generation[handle.slot];
+	slots.is_3D[handle.slot] = command.is_3D;
+	slots.streams[handle.slot] = stream;
+
+	command.type = Command::Play;
+	command.slot = handle.slot;
+	command.generation = handle.generation;
+	command.stream = stream.get();
+	if (!send(command)) {
+		//the audio callback will never hear about this voice, so take its slot back now:
+		slots.streams[handle.slot].reset();
+		slots.free.emplace_back(handle.slot);
+		return Sound::PlayingSample();
+	}
+
+	return handle;
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+static Command play_2D_command(float play_volume, float pan, bool loop) {
+	Command command;
+	command.value = play_volume;
+	command.value2 = pan;
+	command.loop = loop;
+	return command;
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+static Command play_3D_command(float play_volume, glm::vec3 const &position, float half_volume_radius, bool loop) {
+	Command command;
+	command.is_3D = true;
+	command.value = play_volume;
+	command.vec = position;
+	command.value2 = half_volume_radius;
+	command.loop = loop;
+	return command;
 }
 
+static Command with_sample(Command command, Sound::Sample const &sample) {
+	if (sample.format == Sound::Sample::Format::Float32) command.data = sample.data.data();
+	else command.data = sample.packed.data();
+	command.format = sample.format;
+	command.data_size = sample.length;
+	return command;
+}
+
+Sound::PlayingSample Sound::play(Sample const &sample, float play_volume, float pan) {
+	return start(with_sample(play_2D_command(play_volume, pan, false), sample), nullptr);
+}
+
+Sound::PlayingSample Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	return start(with_sample(play_3D_command(play_volume, position, half_volume_radius, false), sample), nullptr);
+}
+
+Sound::PlayingSample Sound::loop(Sample const &sample, float play_volume, float pan) {
+	return start(with_sample(play_2D_command(play_volume, pan, true), sample), nullptr);
+}
 
+Sound::PlayingSample Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	return start(with_sample(play_3D_command(play_volume, position, half_volume_radius, true), sample), nullptr);
+}
+
+Sound::PlayingSample Sound::play(Stream const &stream, float play_volume, float pan) {
+	return start(play_2D_command(play_volume, pan, false), start_stream(stream, false));
+}
+
+Sound::PlayingSample Sound::play_3D(Stream const &stream, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	return start(play_3D_command(play_volume, position, half_volume_radius, false), start_stream(stream, false));
+}
+
+Sound::PlayingSample Sound::loop(Stream const &stream, float play_volume, float pan) {
+	return start(play_2D_command(play_volume, pan, true), start_stream(stream, true));
+}
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingSample Sound::loop_3D(Stream const &stream, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	return start(play_3D_command(play_volume, position, half_volume_radius, true), start_stream(stream, true));
 }
 
 
 void Sound::stop_all_samples() {
-	lock();
-	for (auto &s : playing_samples) {
-		s->stop();
-	}
-	unlock();
+	Command command;
+	command.type = Command::StopAll;
+	command.ramp = 1.0f / 60.0f;
+	send(command);
+}
+
+void Sound::set_max_real_voices(uint32_t count) {
+	Command command;
+	command.type = Command::SetMaxRealVoices;
+	command.value = float(std::min(count, MaxVoices));
+	send(command);
+}
+
+Sound::VoiceCounts Sound::voice_counts() {
+	VoiceCounts counts;
+	counts.real = real_count.load(std::memory_order_relaxed);
+	counts.virtual_ = virtual_count.load(std::memory_order_relaxed);
+	return counts;
+}
+
+void Sound::set_bus_volume(Bus bus, float new_volume, float ramp) {
+	Command command;
+	command.type = Command::SetBusVolume;
+	command.bus = bus;
+	command.value = new_volume;
+	command.ramp = ramp;
+	send(command);
 }
 
 void Sound::set_volume(float new_volume, float ramp) {
-	lock();
-	volume.set(new_volume, ramp);
-	unlock();
+	Command command;
+	command.type = Command::SetMasterVolume;
+	command.value = new_volume;
+	command.ramp = ramp;
+	send(command);
 }
 
 //------------------
 
-void Sound::PlayingSample::set_volume(float new_volume, float ramp) {
-	Sound::lock();
-	if (!stopping) {
-		volume.set(new_volume, ramp);
-	}
-	Sound::unlock();
+bool Sound::PlayingSample::stopped() const {
+	if (slot == InvalidSlot) return true;
+	reclaim();
+	return slots.generation[slot] != generation;
 }
 
-void Sound::PlayingSample::set_pan(float new_pan, float ramp) {
-	if (!(pan.value == pan.value)) return; //ignore if not in '2D' mode
-	Sound::lock();
-	pan.set(new_pan, ramp);
-	Sound::unlock();
+//command for the voice this handle refers to:
+static Command voice_command(Sound::PlayingSample const &handle, Command::Type type) {
+	Command command;
+	command.type = type;
+	command.slot = handle.slot;
+	command.generation = handle.generation;
+	return command;
 }
 
-void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	position.set(new_position, ramp);
-	Sound::unlock();
+void Sound::PlayingSample::set_volume(float new_volume, float ramp) const {
+	if (stopped()) return;
+	Command command = voice_command(*this, Command::SetVolume);
+	command.value = new_volume;
+	command.ramp = ramp;
+	send(command);
 }
 
-void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	half_volume_radius.set(new_radius, ramp);
-	Sound::unlock();
+void Sound::PlayingSample::set_pan(float new_pan, float ramp) const {
+	if (stopped() || slots.is_3D[slot]) return; //ignore if not in '2D' mode
+	Command command = voice_command(*this, Command::SetPan);
+	command.value = new_pan;
+	command.ramp = ramp;
+	send(command);
 }
 
-void Sound::PlayingSample::stop(float ramp) {
-	Sound::lock();
-	if (!(stopping || stopped)) {
-		stopping = true;
-		volume.target = 0.0f;
-		volume.ramp = ramp;
-	} else {
-		volume.ramp = std::min(volume.ramp, ramp);
+void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) const {
+	if (stopped() || !slots.is_3D[slot]) return; //ignore if not in '3D' mode
+	Command command = voice_command(*this, Command::SetPosition);
+	command.vec = new_position;
+	command.ramp = ramp;
+	send(command);
+}
+
+void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) const {
+	if (stopped() || !slots.is_3D[slot]) return; //ignore if not in '3D' mode
+	Command command = voice_command(*this, Command::SetHalfVolumeRadius);
+	command.value = new_radius;
+	command.ramp = ramp;
+	send(command);
+}
+
+void Sound::PlayingSample::set_bus(Bus new_bus) const {
+	if (stopped()) return;
+	Command command = voice_command(*this, Command::SetBus);
+	command.bus = new_bus;
+	send(command);
+}
+
+void Sound::PlayingSample::set_rate(float new_rate, float ramp) const {
+	if (stopped()) return;
+	Command command = voice_command(*this, Command::SetRate);
+	command.value = glm::clamp(new_rate, 1.0f / 16.0f, 16.0f);
+	command.ramp = ramp;
+	send(command);
+}
+
+void Sound::PlayingSample::set_priority(float new_priority) const {
+	if (stopped()) return;
+	Command command = voice_command(*this, Command::SetPriority);
+	command.value = new_priority;
+	send(command);
+}
+
+void Sound::PlayingSample::stop(float ramp) const {
+	if (stopped()) return;
+	Command command = voice_command(*this, Command::Stop);
+	command.ramp = ramp;
+	send(command);
+}
+
+void Sound::PlayingSample::seek(double time) const {
+	if (stopped()) return;
+	Command command = voice_command(*this, Command::Seek);
+	command.sample = uint64_t(std::max(0.0, time * double(SAMPLE_RATE)));
+	if (Sound::StreamReader const *stream = slots.streams[slot].get()) {
+		if (stream->loop && stream->length > 0) command.sample %= stream->length;
+		else command.sample = std::min(command.sample, stream->length);
 	}
-	Sound::unlock();
+	send(command);
 }
 
 //------------------
 
 void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp) {
-	Sound::lock();
-	position.set(new_position, ramp);
+	Command command;
+	command.type = Command::SetListener;
+	command.vec = new_position;
 	//some extra code to make sure right is always a unit vector:
 	if (new_right == glm::vec3(0.0f)) {
-		right.set(glm::vec3(1.0f, 0.0f, 0.0f), ramp);
+		command.vec2 = glm::vec3(1.0f, 0.0f, 0.0f);
 	} else {
-		right.set(glm::normalize(new_right), ramp);
+		command.vec2 = glm::normalize(new_right);
 	}
-	Sound::unlock();
+	command.ramp = ramp;
+	send(command);
 }
 
 //------------------------ internals --------------------------------
 
 
+//helper: fade a voice out over 'ramp' seconds, after which mix_audio removes it:
+static void stop_voice(Voice &voice, float ramp) {
+	if (!voice.stopping) {
+		voice.stopping = true;
+		voice.volume.target = 0.0f;
+		voice.volume.ramp = ramp;
+	} else {
+		voice.volume.ramp = std::min(voice.volume.ramp, ramp);
+	}
+}
+
 //helper: equal-power panning
 inline void compute_pan_weights(float pan, float *left, float *right) {
 	//clamp pan to -1 to 1 range:
@@ -251,34 +1005,33 @@ void compute_pan_from_listener_and_position(
 	}
 }
 
-//helper: ramp updates...
-constexpr float const RAMP_STEP = float(MIX_SAMPLES) / float(AUDIO_RATE);
+//helper: ramp updates (advancing by 'dt' seconds; the mixer uses block_time)...
 
 //helper: ...for single values:
-void step_value_ramp(Sound::Ramp< float > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+void step_value_ramp(Sound::Ramp< float > &ramp, float dt) {
+	if (ramp.ramp <= dt) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
-		ramp.value += (RAMP_STEP / ramp.ramp) * (ramp.target - ramp.value);
-		ramp.ramp -= RAMP_STEP;
+		ramp.value += (dt / ramp.ramp) * (ramp.target - ramp.value);
+		ramp.ramp -= dt;
 	}
 }
 
 //helper: ...for 3D positions:
-void step_position_ramp(Sound::Ramp< glm::vec3 > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+void step_position_ramp(Sound::Ramp< glm::vec3 > &ramp, float dt) {
+	if (ramp.ramp <= dt) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
-		ramp.value = glm::mix(ramp.value, ramp.target, RAMP_STEP / ramp.ramp);
-		ramp.ramp -= RAMP_STEP;
+		ramp.value = glm::mix(ramp.value, ramp.target, dt / ramp.ramp);
+		ramp.ramp -= dt;
 	}
 }
 
 //helper: ...for 3D directions:
-void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp, float dt) {
+	if (ramp.ramp <= dt) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
@@ -302,137 +1055,537 @@ void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
 		float angle = std::acos(glm::clamp(glm::dot(ramp.value, ramp.target), -1.0f, 1.0f));
 
 		//figure out new target value by moving angle toward target:
-		angle *= (ramp.ramp - RAMP_STEP) / ramp.ramp;
+		angle *= (ramp.ramp - dt) / ramp.ramp;
 
 		ramp.value = ramp.target * std::cos(angle) + perp * std::sin(angle);
-		ramp.ramp -= RAMP_STEP;
+		ramp.ramp -= dt;
+	}
+}
+
+
+//values shared by all voices mixed in one block:
+struct BlockParams {
+	float start_volume, end_volume;
+	glm::vec3 start_position, end_position;
+	glm::vec3 start_right, end_right;
+};
+
+//rough loudness of a voice (ignoring panning and the sample's content), used to pick which voices to mix:
+static float estimate_gain(Voice const &voice, glm::vec3 const &listener_position) {
+	float gain = voice.volume.value;
+	if (voice.is_3D) {
+		//same distance attenuation as compute_pan_from_listener_and_position:
+		float distance = glm::length(voice.position.value - listener_position);
+		gain *= 1.0f / (1.0f + (distance / voice.half_volume_radius.value));
+	}
+	return gain;
+}
+
+//panning for a voice at the start or end of a block, specialized for 2D/3D voices:
+template< bool Is3D >
+static void compute_voice_pan(Voice const &voice, glm::vec3 const &listener_position, glm::vec3 const &listener_right, float *left, float *right) {
+	if (Is3D) {
+		compute_pan_from_listener_and_position(
+			listener_position, listener_right,
+			voice.position.value,
+			voice.half_volume_radius.value,
+			left, right);
+	} else {
+		compute_pan_weights(voice.pan.value, left, right);
+	}
+}
+
+//decode data values [begin, begin + count) of a (non-stream) voice to floats:
+static void decode_run(Voice const &voice, uint32_t begin, uint32_t count, float *dst) {
+	if (voice.format == Sound::Sample::Format::Float32) {
+		float const *data = static_cast< float const * >(voice.data);
+		std::copy(data + begin, data + begin + count, dst);
+	} else if (voice.format == Sound::Sample::Format::Int16) {
+		decode_int16(static_cast< uint8_t const * >(voice.data), begin, count, dst);
+	} else {
+		decode_adpcm(static_cast< uint8_t const * >(voice.data), begin, count, dst);
+	}
+}
+
+//copy the next 'count' data values of a voice (without advancing past them), wrapping around at loop points
+// and padding with zeros after the end; returns how many were copied (only ever short for a stream that is behind):
+static uint32_t read_source(Voice const &voice, uint32_t count, float *dst) {
+	if (voice.stream) return voice.stream->peek(count, dst);
+	uint32_t at = voice.i;
+	uint32_t done = 0;
+	while (done < count) {
+		if (at >= voice.data_size) {
+			if (!voice.loop || voice.data_size == 0) {
+				std::fill(dst + done, dst + count, 0.0f);
+				break;
+			}
+			at = 0;
+		}
+		uint32_t run = std::min(count - done, voice.data_size - at);
+		decode_run(voice, at, run, dst + done);
+		done += run;
+		at += run;
+	}
+	return count;
+}
+
+//move a voice 'count' data values forward:
+static void advance_source(Voice &voice, uint32_t count) {
+	if (voice.stream) {
+		voice.stream->advance(count);
+	} else if (voice.loop && voice.data_size > 0) {
+		voice.i = uint32_t((uint64_t(voice.i) + count) % voice.data_size);
+	} else {
+		voice.i = uint32_t(std::min(uint64_t(voice.i) + count, uint64_t(voice.data_size)));
+	}
+}
+
+//mix one voice into 'buffer' (interleaved stereo, mix_samples long); returns true if the voice has finished:
+// the voice's gain is additionally faded from 'fade_start' to 'fade_end' over the block;
+// if both are zero the voice is 'virtual': it advances (and its ramps update) but isn't mixed.
+template< bool Is3D >
+static bool mix_voice(Voice &voice, BlockParams const &block, float *buffer, float fade_start, float fade_end) {
+	bool silent = (fade_start == 0.0f && fade_end == 0.0f);
+
+	//Figure out sample panning/volume at start...
+	float start_l = 0.0f, start_r = 0.0f;
+	if (!silent) compute_voice_pan< Is3D >(voice, block.start_position, block.start_right, &start_l, &start_r);
+	if (Is3D) {
+		step_position_ramp(voice.position, block_time);
+		step_value_ramp(voice.half_volume_radius, block_time);
+	} else {
+		step_value_ramp(voice.pan, block_time);
+	}
+	start_l *= block.start_volume * voice.volume.value * fade_start;
+	start_r *= block.start_volume * voice.volume.value * fade_start;
+
+	step_value_ramp(voice.volume, block_time);
+
+	//..and end of the mix period:
+	float end_l = 0.0f, end_r = 0.0f;
+	if (!silent) compute_voice_pan< Is3D >(voice, block.end_position, block.end_right, &end_l, &end_r);
+	end_l *= block.end_volume * voice.volume.value * fade_end;
+	end_r *= block.end_volume * voice.volume.value * fade_end;
+
+	//figure out a step to add at each sample so that pan will move smoothly from start to end:
+	float step_l = (end_l - start_l) / mix_samples;
+	float step_r = (end_r - start_r) / mix_samples;
+	bool ramp = (step_l != 0.0f || step_r != 0.0f);
+
+	//add 'count' samples of 'src' to the buffer at 'mixed':
+	auto mix = [&](float const *src, uint32_t count, uint32_t mixed) {
+		float gain_l = start_l + float(mixed) * step_l;
+		float gain_r = start_r + float(mixed) * step_r;
+		if (ramp) {
+			mix_mono_to_stereo< true >(src, count, buffer + 2 * mixed, gain_l, gain_r, step_l, step_r);
+		} else {
+			mix_mono_to_stereo< false >(src, count, buffer + 2 * mixed, gain_l, gain_r, 0.0f, 0.0f);
+		}
+	};
+
+	//data values per output sample (the rate ramps per-block):
+	float step = voice.rate.value * source_step;
+	step_value_ramp(voice.rate, block_time);
+
+	alignas(32) std::array< float, 256 > decoded;
+	uint32_t mixed = 0;
+	if (step == 1.0f && voice.frac == 0.0f) {
+		//one data value per output sample: mix contiguous runs of source audio directly
+		// (split at loop points, stream ring wrap-around, and decode chunks):
+		while (mixed < mix_samples) {
+			float const *src = nullptr;
+			uint32_t count = 0;
+			if (voice.stream) {
+				count = voice.stream->fetch(mix_samples - mixed, &src);
+			} else {
+				if (voice.i == voice.data_size && voice.loop) {
+					voice.i = 0;
+				}
+				count = std::min(mix_samples - mixed, voice.data_size - voice.i);
+				if (voice.format == Sound::Sample::Format::Float32) {
+					src = static_cast< float const * >(voice.data) + voice.i;
+				} else {
+					//compact formats are decoded a chunk at a time (virtual voices skip decoding entirely):
+					count = std::min(count, uint32_t(decoded.size()));
+					if (!silent) decode_run(voice, voice.i, count, decoded.data());
+					src = decoded.data();
+				}
+			}
+			if (count == 0) break; //sample is over (or stream is behind; it will catch up next block)
+
+			if (!silent) {
+				mix(src, count, mixed);
+				voice.previous = src[count - 1];
+			}
+			mixed += count;
+			advance_source(voice, count);
+		}
+	} else {
+		//resampling: gather the data values under each chunk of output into 'window', then interpolate:
+		std::array< float, 2048 + 8 > window;
+		while (mixed < mix_samples) {
+			uint32_t count = std::min(mix_samples - mixed, uint32_t(decoded.size()));
+			//(keeping within the window, with a little slack for rounding)
+			count = std::min(count, uint32_t((float(window.size() - 6) - voice.frac) / step));
+			uint32_t needed = uint32_t(voice.frac + float(count) * step) + 3;
+			window[0] = voice.previous;
+			bool gather = (!silent || voice.stream); //(virtual voices only need to know how far to advance)
+			uint32_t got = needed;
+			if (gather) got = read_source(voice, needed, window.data() + 1);
+			if (got < needed) {
+				//stream is behind; resample only as far as it goes (it will catch up next block):
+				float fit = (float(got) - 4.0f - voice.frac) / step;
+				if (fit < 1.0f) break;
+				count = std::min(count, uint32_t(fit));
+			}
+
+			if (!silent) {
+				if (cubic) resample< Interpolation::Cubic >(window.data(), voice.frac, step, count, decoded.data());
+				else resample< Interpolation::Linear >(window.data(), voice.frac, step, count, decoded.data());
+				mix(decoded.data(), count, mixed);
+			}
+
+			float end = voice.frac + float(count) * step;
+			uint32_t consumed = uint32_t(end);
+			voice.frac = end - float(consumed);
+			voice.previous = (gather ? window[consumed] : 0.0f); //(data value i + consumed - 1)
+			mixed += count;
+			advance_source(voice, consumed);
+			if (!voice.stream && !voice.loop && voice.i == voice.data_size) break;
+		}
 	}
+
+	bool finished;
+	if (voice.stream) {
+		finished = voice.stream->finished();
+	} else {
+		finished = (voice.i >= voice.data_size && !voice.loop) || voice.data_size == 0;
+	}
+	return finished || (voice.stopping && voice.volume.value == 0.0f);
 }
 
+//apply a command sent from the game thread:
+static void apply(Command const &command) {
+	if (command.type == Command::Play) {
+		assert(voice_count < voices.size()); //(slots are never handed out twice)
+		Voice &voice = voices[voice_count];
+		voice = Voice();
+		voice.slot = command.slot;
+		voice.generation = command.generation;
+		voice.data = command.data;
+		voice.format = command.format;
+		voice.data_size = command.data_size;
+		voice.stream = command.stream;
+		voice.is_3D = command.is_3D;
+		voice.loop = command.loop;
+		voice.volume = Sound::Ramp< float >(command.value);
+		if (voice.is_3D) {
+			voice.position = Sound::Ramp< glm::vec3 >(command.vec);
+			voice.half_volume_radius = Sound::Ramp< float >(command.value2);
+		} else {
+			voice.pan = Sound::Ramp< float >(command.value2);
+		}
+		voice_index[command.slot] = voice_count;
+		voice_count += 1;
+		return;
+	}
+
+	if (command.type == Command::SetMasterVolume) {
+		Sound::volume.set(command.value, command.ramp);
+	} else if (command.type == Command::SetListener) {
+		Sound::listener.position.set(command.vec, command.ramp);
+		Sound::listener.right.set(command.vec2, command.ramp);
+	} else if (command.type == Command::SetBusVolume) {
+		bus_volume[uint32_t(command.bus)].set(command.value, command.ramp);
+	} else if (command.type == Command::SetMaxRealVoices) {
+		max_real_voices = uint32_t(command.value);
+	} else if (command.type == Command::StopAll) {
+		for (uint32_t v = 0; v < voice_count; ++v) {
+			stop_voice(voices[v], command.ramp);
+		}
+	} else {
+		//command for a single voice; skip it if the voice has already finished:
+		uint32_t index = voice_index[command.slot];
+		if (index == NotPlaying || voices[index].generation != command.generation) return;
+		Voice &voice = voices[index];
+		switch (command.type) {
+			case Command::SetVolume:
+				if (!voice.stopping) voice.volume.set(command.value, command.ramp);
+				break;
+			case Command::SetPan:
+				voice.pan.set(command.value, command.ramp);
+				break;
+			case Command::SetPosition:
+				voice.position.set(command.vec, command.ramp);
+				break;
+			case Command::SetHalfVolumeRadius:
+				voice.half_volume_radius.set(command.value, command.ramp);
+				break;
+			case Command::SetBus:
+				voice.bus = command.bus;
+				break;
+			case Command::SetRate:
+				voice.rate.set(command.value, command.ramp);
+				break;
+			case Command::SetPriority:
+				voice.priority = command.value;
+				break;
+			case Command::Stop:
+				stop_voice(voice, command.ramp);
+				break;
+			case Command::Seek:
+				if (voice.stream) {
+					//the streaming thread does the actual seek (and resets the ring); wake it so the gap is short:
+					voice.stream->seek_request.store(int64_t(command.sample), std::memory_order_release);
+					streamer.wake.notify_one();
+				} else if (voice.loop && voice.data_size > 0) voice.i = uint32_t(command.sample % voice.data_size);
+				else voice.i = uint32_t(std::min(command.sample, uint64_t(voice.data_size)));
+				voice.frac = 0.0f;
+				voice.previous = 0.0f;
+				break;
+			default:
+				break;
+		}
+	}
+}
 
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void mix_audio(void *, Uint8 *buffer_, int len) {
 	assert(buffer_); //should always have some audio buffer
+	float *buffer = reinterpret_cast< float * >(buffer_);
 
-	struct LR {
-		float l;
-		float r;
-	};
-	static_assert(sizeof(LR) == 8, "Sample is packed");
-	assert(len == MIX_SAMPLES * sizeof(LR)); //should always have the expected number of samples
-	LR *buffer = reinterpret_cast< LR * >(buffer_);
+	{ //a long gap since the last callback means the device probably ran out of audio:
+		auto now = std::chrono::steady_clock::now();
+		float buffer_time = float(uint32_t(len) / (2 * sizeof(float))) / float(audio_rate);
+		if (callback_started && std::chrono::duration< float >(now - last_callback).count() > 1.5f * buffer_time) {
+			stat.xruns.fetch_add(1, std::memory_order_relaxed);
+		}
+		last_callback = now;
+		callback_started = true;
+	}
 
-	//zero the output buffer:
-	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
-		buffer[s].l = 0.0f;
-		buffer[s].r = 0.0f;
+	if (!premix_enabled) {
+		assert(uint32_t(len) == mix_samples * 2 * sizeof(float)); //should always have the expected number of (stereo) samples
+		mix_block(buffer);
+		return;
 	}
 
-	//update global values:
-	float start_volume = Sound::volume.value;
-	glm::vec3 start_position =  Sound::listener.position.value;
-	glm::vec3 start_right =  Sound::listener.right.value;
-
-	step_value_ramp(Sound::volume);
-	step_position_ramp( Sound::listener.position);
-	step_direction_ramp( Sound::listener.right);
-
-	float end_volume = Sound::volume.value;
-	glm::vec3 end_position =  Sound::listener.position.value;
-	glm::vec3 end_right =  Sound::listener.right.value;
-
-	//add audio from each playing sample into the buffer:
-	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-		Sound::PlayingSample &playing_sample = **si; //much more convenient than writing ** everywhere.
-
-		//Figure out sample panning/volume at start...
-		LR start_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				start_position, start_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&start_pan.l, &start_pan.r);
-
-			step_position_ramp(playing_sample.position);
-			step_value_ramp(playing_sample.half_volume_radius);
-		} else {
-			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &start_pan.l, &start_pan.r);
+	//premix mode: copy out whatever the premix thread has ready:
+	uint32_t frames = uint32_t(len) / (2 * sizeof(float));
+	uint64_t r = premix.read.load(std::memory_order_relaxed);
+	uint32_t available = uint32_t(premix.written.load(std::memory_order_acquire) - r);
+	uint32_t count = std::min(frames, available);
+	for (uint32_t f = 0; f < count; ) {
+		uint32_t at = uint32_t((r + f) & (premix.frames - 1));
+		uint32_t run = std::min(count - f, premix.frames - at); //(don't run off the end of the ring)
+		std::copy(premix.ring.data() + 2 * at, premix.ring.data() + 2 * (at + run), buffer + 2 * f);
+		f += run;
+	}
+	premix.read.store(r + count, std::memory_order_release);
+	if (count < frames) {
+		//mixer fell behind; play silence rather than waiting:
+		std::fill(buffer + 2 * count, buffer + 2 * frames, 0.0f);
+		premix.underruns.fetch_add(1, std::memory_order_relaxed);
+		stat.underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+}
 
-			step_value_ramp(playing_sample.pan);
+//body of the premix thread: keep the ring filled to the latency target:
+static void premix_loop() {
+	//how long to wait when the ring is full (a quarter of a block):
+	auto const nap = std::chrono::microseconds(uint64_t(250000.0 * mix_samples / audio_rate));
+	while (!premix.quit.load()) {
+		uint64_t w = premix.written.load(std::memory_order_relaxed);
+		uint64_t buffered = w - premix.read.load(std::memory_order_acquire);
+		if (buffered + mix_samples > premix.target) {
+			std::this_thread::sleep_for(nap);
+			continue;
 		}
-		start_pan.l *= start_volume * playing_sample.volume.value;
-		start_pan.r *= start_volume * playing_sample.volume.value;
-
-		step_value_ramp(playing_sample.volume);
-
-		//..and end of the mix period:
-		LR end_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				end_position, end_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&end_pan.l, &end_pan.r);
-		} else {
-			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &end_pan.l, &end_pan.r);
+		{ //(ring size is a multiple of the block size, so each block is contiguous)
+			std::unique_lock< std::mutex > lock(premix.mix_mutex);
+			mix_block(premix.ring.data() + 2 * (w & (premix.frames - 1)));
 		}
+		premix.written.store(w + mix_samples, std::memory_order_release);
+	}
+}
 
-		end_pan.l *= end_volume * playing_sample.volume.value;
-		end_pan.r *= end_volume * playing_sample.volume.value;
+//block being mixed (for mix_chunk()):
+static BlockParams const *chunk_block = nullptr;
+
+//mix the voices in chunks[c] into the chunk's buffer (may run on any thread of mix_pool):
+static void mix_chunk(uint32_t c) {
+	auto before = std::chrono::steady_clock::now();
+
+	Chunk const &chunk = chunks[c];
+	float *out = chunk_buffers.data() + size_t(c) * 2 * mix_samples;
+	std::fill(out, out + 2 * mix_samples, 0.0f);
+	for (uint32_t i = chunk.begin; i < chunk.end; ++i) {
+		uint32_t v = chunk_voices[i];
+		Voice &voice = voices[v];
+		if (voice.is_3D) finished[v] = mix_voice< true >(voice, *chunk_block, out, fade_start[v], fade_end[v]);
+		else finished[v] = mix_voice< false >(voice, *chunk_block, out, fade_start[v], fade_end[v]);
+	}
 
-		//figure out a step to add at each sample so that pan will move smoothly from start to end:
-		LR pan = start_pan;
-		LR pan_step;
-		pan_step.l = (end_pan.l - start_pan.l) / MIX_SAMPLES;
-		pan_step.r = (end_pan.r - start_pan.r) / MIX_SAMPLES;
+	chunk_time[c] = uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - before).count());
+}
 
-		assert(playing_sample.i < playing_sample.data.size());
+//Mix one block (mix_samples frames of interleaved stereo) into 'buffer':
+static void mix_block(float *buffer) {
+	auto before = std::chrono::steady_clock::now();
 
-		for (uint32_t i = 0; i < MIX_SAMPLES; ++i) {
-			//mix one sample based on current pan values:
-			buffer[i].l += pan.l * playing_sample.data[playing_sample.i];
-			buffer[i].r += pan.r * playing_sample.data[playing_sample.i];
+	//zero the output buffer:
+	std::fill(buffer, buffer + 2 * mix_samples, 0.0f);
+
+	//catch up on changes from the game thread:
+	Command command;
+	uint32_t drained = 0;
+	while (commands.pop(&command)) {
+		apply(command);
+		drained += 1;
+	}
 
-			//update position in sample:
-			playing_sample.i += 1;
-			if (playing_sample.i == playing_sample.data.size()) {
-				if (playing_sample.loop) {
-					playing_sample.i = 0;
-				} else {
-					break;
-				}
+	//update global values:
+	BlockParams block;
+	block.start_volume = Sound::volume.value;
+	block.start_position =  Sound::listener.position.value;
+	block.start_right =  Sound::listener.right.value;
+
+	step_value_ramp(Sound::volume, block_time);
+	step_position_ramp( Sound::listener.position, block_time);
+	step_direction_ramp( Sound::listener.right, block_time);
+
+	block.end_volume = Sound::volume.value;
+	block.end_position =  Sound::listener.position.value;
+	block.end_right =  Sound::listener.right.value;
+
+	//decide which voices to mix for real:
+	bool virtualize = (voice_count > max_real_voices);
+	if (virtualize) {
+		for (uint32_t v = 0; v < voice_count; ++v) {
+			audibility[v] = estimate_gain(voices[v], block.start_position) * std::max(0.0f, voices[v].priority);
+			ranked[v] = v;
+		}
+		//the loudest 'max_real_voices' end up at the front (ties go to the lower index, so the choice is stable):
+		std::nth_element(ranked.begin(), ranked.begin() + max_real_voices, ranked.begin() + voice_count, [](uint32_t a, uint32_t b){
+			if (audibility[a] != audibility[b]) return audibility[a] > audibility[b];
+			return a < b;
+		});
+		for (uint32_t r = 0; r < voice_count; ++r) {
+			audibility[ranked[r]] = (r < max_real_voices ? 1.0f : 0.0f); //(re-used as "is real this block" flag)
+		}
+	}
+	uint32_t mixed_count = 0; //voices mixed this block (including ones fading out to virtual)
+	uint32_t skipped_count = 0; //virtual voices
+
+	//fade in voices that just became real, and fade out ones that just became virtual:
+	for (uint32_t v = 0; v < voice_count; ++v) {
+		Voice &voice = voices[v];
+		bool real = (!virtualize || audibility[v] != 0.0f);
+		fade_start[v] = ((voice.fresh ? real : voice.real) ? 1.0f : 0.0f);
+		fade_end[v] = (real ? 1.0f : 0.0f);
+		voice.real = real;
+		voice.fresh = false;
+		if (fade_start[v] != 0.0f || fade_end[v] != 0.0f) mixed_count += 1;
+		else skipped_count += 1;
+	}
+
+	//split each bus's voices into chunks:
+	chunk_count = 0;
+	uint32_t grouped = 0;
+	for (uint32_t b = 0; b < Sound::BusCount; ++b) {
+		for (uint32_t v = 0; v < voice_count; ++v) {
+			if (uint32_t(voices[v].bus) != b) continue;
+			if (chunk_count == 0 || uint32_t(chunks[chunk_count-1].bus) != b || chunks[chunk_count-1].end - chunks[chunk_count-1].begin == ChunkVoices) {
+				chunks[chunk_count] = Chunk{ Sound::Bus(b), grouped, grouped };
+				chunk_count += 1;
 			}
+			chunk_voices[grouped] = v;
+			grouped += 1;
+			chunks[chunk_count-1].end = grouped;
+		}
+	}
 
-			//update pan values:
-			pan.l += pan_step.l;
-			pan.r += pan_step.r;
+	//mix the chunks:
+	chunk_block = &block;
+	if (mix_pool && chunk_count > 1) {
+		mix_pool->run(chunk_count, mix_chunk);
+	} else {
+		for (uint32_t c = 0; c < chunk_count; ++c) {
+			mix_chunk(c);
 		}
+	}
 
-		if (playing_sample.i >= playing_sample.data.size()
-		 || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
-		 	playing_sample.stopped = true;
-			//erase from list:
-			auto old = si;
-			++si;
-			playing_samples.erase(old);
-		} else {
-			++si;
+	//sum each bus's chunks (in order) and add them to the output at the bus's volume:
+	for (uint32_t b = 0; b < Sound::BusCount; ++b) {
+		float start_volume = bus_volume[b].value;
+		step_value_ramp(bus_volume[b], block_time);
+		float end_volume = bus_volume[b].value;
+
+		float *sum = nullptr;
+		uint64_t time = 0;
+		for (uint32_t c = 0; c < chunk_count; ++c) {
+			if (uint32_t(chunks[c].bus) != b) continue;
+			float *chunk = chunk_buffers.data() + size_t(c) * 2 * mix_samples;
+			if (sum == nullptr) sum = chunk;
+			else mix_stereo< false >(chunk, mix_samples, sum, 1.0f, 0.0f);
+			time += chunk_time[c];
+		}
+		if (sum) {
+			float step = (end_volume - start_volume) / mix_samples;
+			if (step != 0.0f) mix_stereo< true >(sum, mix_samples, buffer, start_volume, step);
+			else mix_stereo< false >(sum, mix_samples, buffer, start_volume, 0.0f);
 		}
+		cost_bus[b].fetch_add(time, std::memory_order_relaxed);
 	}
 
-	/*//DEBUG: report output power:
-	float max_power = 0.0f;
-	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
-		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
+	//remove finished voices (from the back, so each gap is filled by a voice that has already been checked):
+	for (uint32_t v = voice_count; v > 0; --v) {
+		if (!finished[v-1]) continue;
+		Voice &voice = voices[v-1];
+		//hand the slot back to the game thread, and fill the gap with the last voice:
+		retired.push(uint32_t(voice.slot));
+		voice_index[voice.slot] = NotPlaying;
+		voice_count -= 1;
+		if (v-1 != voice_count) {
+			voice = voices[voice_count];
+			voice_index[voice.slot] = v-1;
+		}
 	}
-	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_samples.size() << std::endl; //DEBUG
-	*/
 
+	real_count.store(mixed_count, std::memory_order_relaxed);
+	virtual_count.store(skipped_count, std::memory_order_relaxed);
+
+	//record mixing time:
+	uint64_t ns = uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - before).count());
+	cost_blocks.fetch_add(1, std::memory_order_relaxed);
+	cost_total.fetch_add(ns, std::memory_order_relaxed);
+	if (ns > cost_peak.load(std::memory_order_relaxed)) cost_peak.store(ns, std::memory_order_relaxed);
+
+	//record health stats:
+	float peak = 0.0f;
+	uint32_t clipped = 0;
+	for (uint32_t s = 0; s < 2 * mix_samples; ++s) {
+		float level = std::abs(buffer[s]);
+		peak = std::max(peak, level);
+		clipped += (level > 1.0f ? 1 : 0);
+	}
+	float load = float(double(ns) * 1e-9) / block_time;
+	uint32_t bin = uint32_t(std::upper_bound(Sound::Stats::LoadEdges.begin(), Sound::Stats::LoadEdges.end(), load) - Sound::Stats::LoadEdges.begin());
+	auto raise = [](auto &counter, auto value) {
+		if (value > counter.load(std::memory_order_relaxed)) counter.store(value, std::memory_order_relaxed);
+	};
+	stat.blocks.fetch_add(1, std::memory_order_relaxed);
+	stat.load[bin].fetch_add(1, std::memory_order_relaxed);
+	raise(stat.load_peak, load);
+	if (load > 1.0f) stat.overruns.fetch_add(1, std::memory_order_relaxed);
+	stat.real_total.fetch_add(mixed_count, std::memory_order_relaxed);
+	stat.virtual_total.fetch_add(skipped_count, std::memory_order_relaxed);
+	raise(stat.real_peak, mixed_count);
+	raise(stat.virtual_peak, skipped_count);
+	stat.commands.fetch_add(drained, std::memory_order_relaxed);
+	raise(stat.commands_peak, drained);
+	raise(stat.peak, peak);
+	stat.clipped.fetch_add(clipped, std::memory_order_relaxed);
 }
 
 
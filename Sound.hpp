@@ -2,29 +2,62 @@
 
 #include <glm/glm.hpp>
 
+#include <array>
+#include <iosfwd>
 #include <memory>
 #include <vector>
 #include <string>
 #include <cmath>
 
+struct DataBlob;
+
 //Game audio system. Simplified from f18-base3.
-//Uses 48kHz sampling rate.
+//Sample data is 48kHz; the output rate and mix block size can be set at startup (see Settings).
 
 namespace Sound {
 
 //Sample objects hold mono (one-channel) audio.
 struct Sample {
+	//How sample data is kept in memory; the compact formats are decoded as they are mixed,
+	// so they trade some mixing time (and, for ADPCM, some quality) for memory:
+	enum class Format : uint8_t {
+		Float32, //4 bytes per sample, in 'data'
+		Int16, //2 bytes per sample, in 'packed'
+		ADPCM, //about 4.5 bits per sample, in 'packed' (see sample_codecs.hpp); fine for most effects
+	};
+
 	//Load from a '.wav' or '.opus' file.
 	//  will warn and convert if sound is not already 48kHz mono:
-	Sample(std::string const &filename);
+	Sample(std::string const &filename, Format format = Format::Float32);
 	
 	//Directly supply an audio buffer:
-	Sample(std::vector< float > const &data);
+	Sample(std::vector< float > const &data, Format format = Format::Float32);
 
-	//sample data is stored as 48kHz, mono, floating-point:
+	Format format = Format::Float32;
+	//sample data is stored as 48kHz, mono, floating-point (Format::Float32 only):
 	std::vector< float > data;
+	//...or encoded as 'format' (other formats):
+	std::vector< uint8_t > packed;
+	uint32_t length = 0; //in samples
+
+	size_t bytes() const { return data.size() * sizeof(float) + packed.size(); } //memory used by audio data
 };
 
+//Stream objects hold compressed audio (from an '.opus' file) which is decoded while it plays.
+//  Use these for long music and ambience: rather than the whole decoded sound,
+//  each playing copy keeps only a short window of decoded audio (see StreamReader in Sound.cpp).
+struct Stream {
+	//Load an '.opus' file (played as 48kHz mono, like Sample):
+	Stream(std::string const &filename);
+
+	std::string filename;
+	std::shared_ptr< DataBlob const > file; //compressed file contents
+	uint64_t length = 0; //length in samples
+};
+
+//decoder + buffer for a playing Stream (defined in Sound.cpp):
+struct StreamReader;
+
 //Ramp<> manages values that should be smoothly interpolated
 //  to a target over a certain amount of time:
 template< typename T >
@@ -48,60 +81,151 @@ struct Ramp {
 	float ramp = 0.0f;
 };
 
-// 'PlayingSample' objects book-keep samples that are currently playing:
+//maximum number of samples (and streams) playing at once; play() returns a stopped handle when all are busy:
+constexpr uint32_t MaxVoices = 4096;
+
+//Voices are mixed in groups ("buses"), each with its own volume (see set_bus_volume()), and then the buses are summed:
+enum class Bus : uint8_t {
+	Effects, //where samples play unless moved with PlayingSample::set_bus()
+	Ambience,
+	Music,
+};
+constexpr uint32_t BusCount = 3;
+
+// 'PlayingSample' is a handle to a sample (or stream) that is playing.
+//  Handles are small values (copy them freely). Once the sound has finished,
+//  the handle goes stale: stopped() returns true and the other functions do nothing.
 struct PlayingSample {
-	//change the panning or volume of a playing sample (and do proper locking);
+	//change the panning or volume of a playing sample (sent to the audio thread without blocking);
 	// value will change over 'ramp' seconds to avoid creating audible artifacts:
-	void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
+	void set_volume(float new_volume, float ramp = 1.0f / 60.0f) const;
 	//set the panning of a sample (use only on samples in "2D" mode; no effect on "3D" samples):
-	void set_pan(float new_pan, float ramp = 1.0f / 60.0f);
+	void set_pan(float new_pan, float ramp = 1.0f / 60.0f) const;
 	//set the position of a sample (use only on samples in "3D" mode; no effect on "2D" samples):
-	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f);
+	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f) const;
 	//set the half-volume radius (use only on "3D" playing sounds):
-	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f);
+	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f) const;
+	//move to a different bus (samples start on Bus::Effects):
+	void set_bus(Bus new_bus) const;
+	//set the playback rate (1.0 == normal; 2.0 == twice as fast and an octave higher; clamped to [1/16, 16]):
+	void set_rate(float new_rate, float ramp = 1.0f / 60.0f) const;
+
+	//when there are more voices than Sound::set_max_real_voices(), only the loudest are mixed;
+	// priority scales how loud this sample counts as (0 == only mixed if there's room):
+	void set_priority(float new_priority) const;
 
 	//'stop' will fade sample out over 'ramp' seconds and then remove it from the active samples:
-	void stop(float ramp = 1.0f / 60.0f);
+	void stop(float ramp = 1.0f / 60.0f) const;
+
+	//jump to 'time' seconds from the start of the sample or stream:
+	// (applied in order with the other commands sent to this sample)
+	void seek(double time) const;
+
+	//has playback stopped (either by running out of sample, by stop(), or because no voice was free)?
+	bool stopped() const;
 
 	//internals:
-	//NOTE: PlayingSample is used in a separate thread; so setting these values directly
-	// may result in bad results. Instead, use the functions above, which perform locking!
-	std::vector< float > const &data; //reference to sample data being played
-	uint32_t i = 0; //next data value to read
-	bool loop = false; //should playback loop after data runs out?
-	bool stopping = false; //is playing stopping?
-	bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
-
-	Ramp< float > volume = Ramp< float >(1.0f);
-
-	//2D playback panning control: ('NaN' if sound played in 3D mode)
-	Ramp< float > pan = Ramp< float >(std::numeric_limits< float >::quiet_NaN());
-
-	//3D playback panning control: ('NaN' if sound played in 2D mode)
-	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
-	Ramp< float > half_volume_radius = std::numeric_limits< float >::quiet_NaN();
-
-	PlayingSample(Sample const &sample_, float volume_, float pan_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), pan(pan_) { }
-	PlayingSample(Sample const &sample_, float volume_, glm::vec3 const &position_, float half_volume_radius_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), position(position_), half_volume_radius(half_volume_radius_) { }
+	static constexpr uint32_t InvalidSlot = ~0U;
+	uint32_t slot = InvalidSlot; //index in the voice pool
+	uint32_t generation = 0; //must match the slot's generation (slots are re-used)
 };
 
 // ------- global functions -------
 
-void init(); //call Sound::init() from main.cpp before using any member functions
+//audio output options for Sound::init():
+struct Settings {
+	uint32_t rate = 48000; //output sampling rate (Hz), from 8000 to 192000; sample data (always 48kHz) is resampled as it plays if this differs
+	bool cubic = true; //resample with a cubic spline (or, if false, by cheaper linear interpolation)
+	//threads that mix voices (including the one calling the mixer; 0 == one per hardware thread).
+	// Each bus's voices are mixed in groups of up to 64, and the groups are spread over the threads;
+	// they are always summed in the same order, so the output doesn't depend on the thread count.
+	// Anything but 1 turns on 'premix' (below), so the audio callback never waits on the other threads:
+	uint32_t mix_threads = 1;
+	//samples mixed at a time: a power of two from 128 to 8192.
+	// Smaller blocks get sounds out sooner (1024 samples is about 21ms at 48kHz; 256 is about 5ms) but cost more per second of audio:
+	uint32_t block_size = 1024;
+
+	//Mix on a separate thread, ahead of the audio device, rather than inside the device's callback.
+	// This adds up to 'premix_latency' seconds of delay, but an occasional slow mix no longer causes a glitch:
+	bool premix = false;
+	float premix_latency = 0.05f; //seconds of audio to keep mixed ahead (rounded up to whole blocks)
+};
+
+void init(Settings const &settings = Settings()); //call Sound::init() from main.cpp before using any member functions
+
+//how the premix thread is keeping up (all zero when not using premix):
+struct PremixStatus {
+	float buffered = 0.0f; //seconds of audio mixed and waiting for the device
+	float capacity = 0.0f; //latency target (seconds)
+	uint32_t underruns = 0; //times the device needed audio that wasn't ready (each plays some silence)
+};
+PremixStatus premix_status();
+
+//time spent mixing since the last call to mix_cost() (or since init):
+struct MixCost {
+	uint32_t blocks = 0; //blocks mixed
+	float average = 0.0f; //seconds per block
+	float peak = 0.0f; //slowest block (seconds)
+	float budget = 0.0f; //audio per block (seconds); mixing a block slower than this causes a glitch
+	std::array< float, BusCount > bus = {}; //seconds per block spent mixing each bus's voices (summed over threads)
+};
+MixCost mix_cost();
+
+//Audio health since the last call to stats() (or since init); the mixer and device callback
+// fill these in without locking, so stats() can be called from any thread (e.g. once a second from the game loop):
+struct Stats {
+	uint32_t blocks = 0; //blocks mixed
+
+	//time to mix each block, as a fraction of the time the block lasts (its "budget"):
+	static constexpr uint32_t LoadBins = 8;
+	static constexpr std::array< float, LoadBins - 1 > LoadEdges{ { 0.125f, 0.25f, 0.5f, 0.75f, 1.0f, 1.5f, 2.0f } };
+	std::array< uint32_t, LoadBins > load = {}; //load[i] counts blocks with LoadEdges[i-1] <= load < LoadEdges[i]
+	float load_peak = 0.0f;
+	uint32_t overruns = 0; //blocks that took longer than their budget (without premix, each is a likely glitch)
+
+	//voices per block (see voice_counts()):
+	float real_average = 0.0f, virtual_average = 0.0f;
+	uint32_t real_peak = 0, virtual_peak = 0;
+
+	//commands from the game thread applied at the start of each block:
+	uint32_t commands = 0;
+	uint32_t commands_peak = 0; //most in one block
+	uint32_t dropped_commands = 0; //sent while the queue was full, so never applied
+
+	//audio device:
+	uint32_t underruns = 0; //(premix only) device needed audio the premix thread hadn't mixed yet
+	uint32_t xruns = 0; //device callback ran more than 1.5 buffers after the previous one (the device likely ran dry)
+
+	//output (after the master volume):
+	float peak = 0.0f; //largest absolute sample value
+	uint32_t clipped = 0; //sample values outside [-1,1] (the device will clip these)
+};
+Stats stats();
+//one-line summary of 'stats' (the format the engine's other reports use):
+std::ostream &operator<<(std::ostream &out, Stats const &stats);
 
 void shutdown(); //call Sound::shutdown() from main.cpp to gracefully(-ish) exit
 
+//Offline rendering (for tools and benchmarks; no audio device needed):
+// call Sound::init_offline() instead of Sound::init(), then Sound::render() to run the mixer.
+// ('settings.premix' is ignored: render() always mixes on the calling thread)
+// Output depends only on the sequence of calls, so is the same every run
+// (except for Streams, which are decoded on another thread and so may fall behind).
+void init_offline(Settings const &settings = Settings());
+//mix 'frames' frames of audio (interleaved left,right) into 'buffer'; 'frames' must be a multiple of block_size():
+void render(float *buffer, uint32_t frames);
+uint32_t block_size(); //frames per mix block
+
 //Call 'Sound::play' to play a sample once.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback early.
-std::shared_ptr< PlayingSample > play(
+//  (the sample must stay alive until playback stops)
+PlayingSample play(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
 //The play_3D version will play a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > play_3D(
+PlayingSample play_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
@@ -110,19 +234,25 @@ std::shared_ptr< PlayingSample > play_3D(
 
 //Call 'Sound::loop' to play a sample ~forever~.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback.
-std::shared_ptr< PlayingSample > loop(
+PlayingSample loop(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
 //The loop_3D version will loop a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > loop_3D(
+PlayingSample loop_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
 	float half_volume_radius = std::numeric_limits< float >::infinity()
 );
 
+//Streams are played with the same functions as samples:
+PlayingSample play(Stream const &stream, float volume = 1.0f, float pan = 0.0f);
+PlayingSample play_3D(Stream const &stream, float volume, glm::vec3 const &position, float half_volume_radius = std::numeric_limits< float >::infinity());
+PlayingSample loop(Stream const &stream, float volume = 1.0f, float pan = 0.0f);
+PlayingSample loop_3D(Stream const &stream, float volume, glm::vec3 const &position, float half_volume_radius = std::numeric_limits< float >::infinity());
+
 //Listener controls the panning of "3D" samples (ones played using the "position" version of the play functions):
 struct Listener {
 	void set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp = 1.0f / 60.0f);
@@ -133,16 +263,36 @@ struct Listener {
 };
 extern struct Listener listener;
 
+//NOTE: the play/set/stop functions send commands to the audio thread through a single-producer queue,
+// so call them from one thread only (usually the main thread).
+// The queue has room for a few commands per voice per block; past that, commands are dropped
+// (and counted in Stats::dropped_commands) rather than waiting or allocating.
+
 //"panic button" to shut off all currently playing sounds:
 void stop_all_samples();
 
+//Voice virtualization: when more than 'count' samples are playing, only the 'count' loudest
+// (estimated from volume, distance, and priority) are mixed; the rest keep their place in
+// the sample silently and fade back in when they become loud enough. (default: 64)
+void set_max_real_voices(uint32_t count);
+
+//voices in the most recent mix block:
+struct VoiceCounts {
+	uint32_t real = 0; //mixed
+	uint32_t virtual_ = 0; //playing, but too quiet to mix
+};
+VoiceCounts voice_counts();
+
+//set the volume of a bus:
+void set_bus_volume(Bus bus, float new_volume, float ramp = 1.0f / 60.0f);
+
 //set global volume:
 void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 extern Ramp< float > volume;
 
 //the audio callback doesn't run between Sound::lock() and Sound::unlock()
-// the set_*/stop/play/... functions already use these helpers, so you shouldn't need
-// to call them unless your code is modifying values directly:
+// the set_*/stop/play/... functions don't need these (they queue commands for the audio thread instead),
+// so only use them if your code is modifying values directly:
 void lock();
 void unlock();
 
@@ -1,6 +1,8 @@
 #include "WalkMesh.hpp"
 
 #include "read_write_chunk.hpp"
+#include "data_files.hpp"
+#include "WorkerPool.hpp"
 
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
@@ -10,19 +12,73 @@
 #include <algorithm>
 #include <string>
 
-WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define WALKMESH_SSE
+#endif
+
+WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_, bool cache_triangles)
 	: vertices(vertices_), normals(normals_), triangles(triangles_) {
 
-	//construct next_vertex map (maps each edge to the next vertex in the triangle):
-	next_vertex.reserve(triangles.size()*3);
-	auto do_next = [this](uint32_t a, uint32_t b, uint32_t c) {
-		auto ret = next_vertex.insert(std::make_pair(glm::uvec2(a,b), c));
-		assert(ret.second);
-	};
+	//group half-edges by starting vertex (a counting sort, so linear time):
+	vertex_edges_begin.assign(vertices.size() + 1, 0);
 	for (auto const &tri : triangles) {
-		do_next(tri.x, tri.y, tri.z);
-		do_next(tri.y, tri.z, tri.x);
-		do_next(tri.z, tri.x, tri.y);
+		vertex_edges_begin[tri.x + 1] += 1;
+		vertex_edges_begin[tri.y + 1] += 1;
+		vertex_edges_begin[tri.z + 1] += 1;
+	}
+	for (uint32_t v = 0; v < vertices.size(); ++v) {
+		vertex_edges_begin[v + 1] += vertex_edges_begin[v];
+	}
+	vertex_edges.resize(triangles.size() * 3);
+	{
+		std::vector< uint32_t > next(vertex_edges_begin.begin(), vertex_edges_begin.end() - 1);
+		for (uint32_t t = 0; t < triangles.size(); ++t) {
+			for (uint32_t e = 0; e < 3; ++e) {
+				vertex_edges[next[triangles[t][e]]++] = 3 * t + e;
+			}
+		}
+	}
+
+	//match each half-edge a->b with b->a, which is among the (few) half-edges starting at b:
+	opposite.assign(triangles.size() * 3, -1U);
+	for (uint32_t t = 0; t < triangles.size(); ++t) {
+		for (uint32_t e = 0; e < 3; ++e) {
+			uint32_t a = triangles[t][e];
+			uint32_t b = triangles[t][(e + 1) % 3];
+			for (uint32_t i = vertex_edges_begin[b]; i < vertex_edges_begin[b + 1]; ++i) {
+				uint32_t h = vertex_edges[i];
+				if (triangles[h / 3][(h % 3 + 1) % 3] == a) {
+					assert(opposite[3 * t + e] == -1U && "each edge should be shared by at most two (consistently oriented) triangles");
+					opposite[3 * t + e] = h;
+				}
+			}
+		}
+	}
+
+	//precompute what walking needs from each triangle's vertices:
+	if (cache_triangles) {
+		triangle_data.reserve(triangles.size());
+		for (auto const &tri : triangles) {
+			glm::vec3 const &a = vertices[tri.x];
+			glm::vec3 const &b = vertices[tri.y];
+			glm::vec3 const &c = vertices[tri.z];
+			//(as in barycentric_weights(), but with the dot products against the point factored out)
+			glm::vec3 v0 = b - a, v1 = c - a;
+			float d00 = glm::dot(v0, v0);
+			float d01 = glm::dot(v0, v1);
+			float d11 = glm::dot(v1, v1);
+			float inv_denom = 1.0f / (d00 * d11 - d01 * d01);
+			TriangleData data;
+			data.to_y = (d11 * v0 - d01 * v1) * inv_denom;
+			data.to_z = (d00 * v1 - d01 * v0) * inv_denom;
+			data.normal = glm::normalize(glm::cross(v0, v1));
+			glm::vec3 const *corners[3] = {&a, &b, &c};
+			for (uint32_t e = 0; e < 3; ++e) {
+				data.inward[e] = glm::cross(data.normal, glm::normalize(*corners[(e + 1) % 3] - *corners[e]));
+			}
+			triangle_data.emplace_back(data);
+		}
 	}
 
 	//DEBUG: are vertex normals consistent with geometric normals?
@@ -38,6 +94,80 @@ WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::
 
 		assert(da > 0.1f && db > 0.1f && dc > 0.1f);
 	}
+
+	//build BVH, splitting each node at the median triangle centroid along its longest axis:
+	constexpr uint32_t LeafTriangles = 4;
+	bvh_triangles.resize(triangles.size());
+	std::vector< glm::vec3 > centroids(triangles.size());
+	float largest = 0.0f; //largest coordinate magnitude (for padding boxes, below)
+	for (uint32_t t = 0; t < triangles.size(); ++t) {
+		bvh_triangles[t] = t;
+		glm::vec3 const &a = vertices[triangles[t].x];
+		glm::vec3 const &b = vertices[triangles[t].y];
+		glm::vec3 const &c = vertices[triangles[t].z];
+		centroids[t] = (a + b + c) / 3.0f;
+		for (glm::vec3 const &v : {a, b, c}) {
+			largest = std::max(largest, std::max(std::abs(v.x), std::max(std::abs(v.y), std::abs(v.z))));
+		}
+	}
+	//boxes are padded a little so that closest points computed with rounding error still land inside them:
+	float pad = 1e-4f * (1.0f + largest);
+
+	if (!triangles.empty()) {
+		bvh.reserve(2 * (triangles.size() / LeafTriangles + 1));
+		bvh.emplace_back();
+		struct Todo {
+			uint32_t node;
+			uint32_t begin, end; //range of bvh_triangles
+			uint32_t depth;
+		};
+		std::vector< Todo > todo;
+		todo.emplace_back(Todo{0, 0, uint32_t(triangles.size()), 1});
+		while (!todo.empty()) {
+			Todo at = todo.back();
+			todo.pop_back();
+			assert(at.depth <= BVHMaxDepth);
+
+			BVHNode node;
+			glm::vec3 centroid_min = glm::vec3(std::numeric_limits< float >::infinity());
+			glm::vec3 centroid_max = glm::vec3(-std::numeric_limits< float >::infinity());
+			for (uint32_t i = at.begin; i < at.end; ++i) {
+				glm::uvec3 const &tri = triangles[bvh_triangles[i]];
+				for (uint32_t v : {tri.x, tri.y, tri.z}) {
+					node.min = glm::min(node.min, vertices[v]);
+					node.max = glm::max(node.max, vertices[v]);
+				}
+				centroid_min = glm::min(centroid_min, centroids[bvh_triangles[i]]);
+				centroid_max = glm::max(centroid_max, centroids[bvh_triangles[i]]);
+			}
+			node.min -= glm::vec3(pad);
+			node.max += glm::vec3(pad);
+
+			if (at.end - at.begin <= LeafTriangles) {
+				node.begin = at.begin;
+				node.count = at.end - at.begin;
+				bvh[at.node] = node;
+				continue;
+			}
+
+			glm::vec3 extent = centroid_max - centroid_min;
+			uint32_t axis = (extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2));
+			uint32_t mid = (at.begin + at.end) / 2;
+			//(ties broken by triangle index, so the tree doesn't depend on the standard library's nth_element)
+			std::nth_element(bvh_triangles.begin() + at.begin, bvh_triangles.begin() + mid, bvh_triangles.begin() + at.end, [&](uint32_t a, uint32_t b) {
+				if (centroids[a][axis] != centroids[b][axis]) return centroids[a][axis] < centroids[b][axis];
+				return a < b;
+			});
+
+			node.begin = uint32_t(bvh.size());
+			node.count = 0;
+			bvh[at.node] = node;
+			bvh.emplace_back();
+			bvh.emplace_back();
+			todo.emplace_back(Todo{node.begin, at.begin, mid, at.depth + 1});
+			todo.emplace_back(Todo{node.begin + 1, mid, at.end, at.depth + 1});
+		}
+	}
 }
 
 //project pt to the plane of triangle a,b,c and return the barycentric weights of the projected point:
@@ -57,110 +187,536 @@ glm::vec3 barycentric_weights(glm::vec3 const &a, glm::vec3 const &b, glm::vec3
 	return glm::vec3(u, v, w);
 }
 
-WalkPoint WalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
-	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
-
-	WalkPoint closest;
+//closest point to 'world_point' on triangle 't' (if it is on an edge, arranged so that weights.z is 0.0); returns the squared distance:
+static float closest_on_triangle(WalkMesh const &wm, uint32_t t, glm::vec3 const &world_point, WalkPoint *closest_) {
+	assert(closest_);
+	auto &closest = *closest_;
 	float closest_dis2 = std::numeric_limits< float >::infinity();
+	glm::uvec3 const &tri = wm.triangles[t];
+	closest.triangle = t;
 
-	for (auto const &tri : triangles) {
-		//find closest point on triangle:
+	glm::vec3 const &a = wm.vertices[tri.x];
+	glm::vec3 const &b = wm.vertices[tri.y];
+	glm::vec3 const &c = wm.vertices[tri.z];
 
-		glm::vec3 const &a = vertices[tri.x];
-		glm::vec3 const &b = vertices[tri.y];
-		glm::vec3 const &c = vertices[tri.z];
+	//get barycentric coordinates of closest point in the plane of (a,b,c):
+	glm::vec3 coords = barycentric_weights(a,b,c, world_point);
 
-		//get barycentric coordinates of closest point in the plane of (a,b,c):
-		glm::vec3 coords = barycentric_weights(a,b,c, world_point);
+	//is that point inside the triangle?
+	if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
+		//yes, point is inside triangle.
+		closest_dis2 = glm::length2(world_point - wm.to_world_point(WalkPoint(tri, coords)));
+		closest.indices = tri;
+		closest.weights = coords;
+	} else {
+		//check triangle vertices and edges:
+		auto check_edge = [&world_point, &closest, &closest_dis2, &wm](uint32_t ai, uint32_t bi, uint32_t ci) {
+			glm::vec3 const &a = wm.vertices[ai];
+			glm::vec3 const &b = wm.vertices[bi];
+
+			//find closest point on line segment ab:
+			float along = glm::dot(world_point-a, b-a);
+			float max = glm::dot(b-a, b-a);
+			glm::vec3 pt;
+			glm::vec3 coords;
+			if (along < 0.0f) {
+				pt = a;
+				coords = glm::vec3(1.0f, 0.0f, 0.0f);
+			} else if (along > max) {
+				pt = b;
+				coords = glm::vec3(0.0f, 1.0f, 0.0f);
+			} else {
+				float amt = along / max;
+				pt = glm::mix(a, b, amt);
+				coords = glm::vec3(1.0f - amt, amt, 0.0f);
+			}
 
-		//is that point inside the triangle?
-		if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
-			//yes, point is inside triangle.
-			float dis2 = glm::length2(world_point - to_world_point(WalkPoint(tri, coords)));
+			float dis2 = glm::length2(world_point - pt);
 			if (dis2 < closest_dis2) {
 				closest_dis2 = dis2;
-				closest.indices = tri;
+				closest.indices = glm::uvec3(ai, bi, ci);
 				closest.weights = coords;
 			}
-		} else {
-			//check triangle vertices and edges:
-			auto check_edge = [&world_point, &closest, &closest_dis2, this](uint32_t ai, uint32_t bi, uint32_t ci) {
-				glm::vec3 const &a = vertices[ai];
-				glm::vec3 const &b = vertices[bi];
-
-				//find closest point on line segment ab:
-				float along = glm::dot(world_point-a, b-a);
-				float max = glm::dot(b-a, b-a);
-				glm::vec3 pt;
-				glm::vec3 coords;
-				if (along < 0.0f) {
-					pt = a;
-					coords = glm::vec3(1.0f, 0.0f, 0.0f);
-				} else if (along > max) {
-					pt = b;
-					coords = glm::vec3(0.0f, 1.0f, 0.0f);
-				} else {
-					float amt = along / max;
-					pt = glm::mix(a, b, amt);
-					coords = glm::vec3(1.0f - amt, amt, 0.0f);
-				}
+		};
+		check_edge(tri.x, tri.y, tri.z);
+		check_edge(tri.y, tri.z, tri.x);
+		check_edge(tri.z, tri.x, tri.y);
+	}
+	return closest_dis2;
+}
+
+//look for triangles closer than *closest_dis2 (or as close, with a lower index than *closest_triangle), updating closest*:
+static void search_bvh(WalkMesh const &wm, glm::vec3 const &world_point, WalkPoint *closest_, float *closest_dis2_, uint32_t *closest_triangle_) {
+	assert(closest_);
+	auto &closest = *closest_;
+	assert(closest_dis2_);
+	auto &closest_dis2 = *closest_dis2_;
+	assert(closest_triangle_);
+	auto &closest_triangle = *closest_triangle_;
+
+	//squared distance from world_point to a node's box:
+	auto box_dis2 = [&world_point](WalkMesh::BVHNode const &node) {
+		glm::vec3 out = glm::max(glm::max(node.min - world_point, world_point - node.max), glm::vec3(0.0f));
+		return glm::dot(out, out);
+	};
 
-				float dis2 = glm::length2(world_point - pt);
-				if (dis2 < closest_dis2) {
+	uint32_t stack[WalkMesh::BVHMaxDepth + 1];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0) {
+		WalkMesh::BVHNode const &node = wm.bvh[stack[--stack_size]];
+		//(nodes at exactly the closest distance are still visited, in case they hold a lower-numbered triangle)
+		if (box_dis2(node) > closest_dis2) continue;
+		if (node.count != 0) {
+			for (uint32_t i = node.begin; i < node.begin + node.count; ++i) {
+				uint32_t t = wm.bvh_triangles[i];
+				WalkPoint wp;
+				float dis2 = closest_on_triangle(wm, t, world_point, &wp);
+				if (dis2 < closest_dis2 || (dis2 == closest_dis2 && t < closest_triangle)) {
+					closest = wp;
 					closest_dis2 = dis2;
-					closest.indices = glm::uvec3(ai, bi, ci);
-					closest.weights = coords;
+					closest_triangle = t;
 				}
-			};
-			check_edge(tri.x, tri.y, tri.z);
-			check_edge(tri.y, tri.z, tri.x);
-			check_edge(tri.z, tri.x, tri.y);
+			}
+		} else {
+			//visit the nearer child first (it's pushed last):
+			float first = box_dis2(wm.bvh[node.begin]);
+			float second = box_dis2(wm.bvh[node.begin + 1]);
+			if (first <= second) {
+				stack[stack_size++] = node.begin + 1;
+				stack[stack_size++] = node.begin;
+			} else {
+				stack[stack_size++] = node.begin;
+				stack[stack_size++] = node.begin + 1;
+			}
 		}
 	}
+}
+
+//(code, index) pairs for 'count' points, sorted by the points' Z-order (Morton order) codes within the box min-max,
+// so that neighbouring entries are (mostly) near each other:
+static void morton_order(glm::vec3 const &min, glm::vec3 const &max, uint32_t count, glm::vec3 const *points, std::vector< std::pair< uint32_t, uint32_t > > *order_) {
+	assert(order_);
+	auto &order = *order_;
+
+	glm::vec3 scale = glm::vec3(1023.0f) / glm::max(max - min, glm::vec3(1e-6f));
+	auto spread = [](uint32_t x) { //put two zero bits between each of the low 10 bits of x
+		x = (x | (x << 16)) & 0x030000ffU;
+		x = (x | (x << 8)) & 0x0300f00fU;
+		x = (x | (x << 4)) & 0x030c30c3U;
+		x = (x | (x << 2)) & 0x09249249U;
+		return x;
+	};
+	order.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		glm::vec3 q = glm::clamp((points[i] - min) * scale, 0.0f, 1023.0f);
+		order[i].first = spread(uint32_t(q.x)) | (spread(uint32_t(q.y)) << 1) | (spread(uint32_t(q.z)) << 2);
+		order[i].second = i;
+	}
+	std::sort(order.begin(), order.end());
+}
+
+WalkPoint WalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
+	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
+
+	WalkPoint closest;
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+	uint32_t closest_triangle = -1U;
+	search_bvh(*this, world_point, &closest, &closest_dis2, &closest_triangle);
+
 	assert(closest.indices.x < vertices.size());
 	assert(closest.indices.y < vertices.size());
 	assert(closest.indices.z < vertices.size());
 	return closest;
 }
 
+void WalkMesh::nearest_walk_points(std::vector< glm::vec3 > const &world_points, std::vector< WalkPoint > *walk_points_) const {
+	assert(walk_points_);
+	auto &walk_points = *walk_points_;
+	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
 
-void WalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end_, float *time_) const {
-	assert(end_);
-	auto &end = *end_;
+	walk_points.resize(world_points.size());
+	if (world_points.empty()) return;
 
-	assert(time_);
-	auto &time = *time_;
+	//answer the queries in Z-order (Morton order) of their positions, so consecutive queries are near each other:
+	std::vector< std::pair< uint32_t, uint32_t > > order;
+	morton_order(bvh[0].min, bvh[0].max, uint32_t(world_points.size()), world_points.data(), &order);
 
-	glm::vec3 const &a = vertices[start.indices.x];
-	glm::vec3 const &b = vertices[start.indices.y];
-	glm::vec3 const &c = vertices[start.indices.z];
+	uint32_t previous_triangle = -1U;
+	for (auto const &[code, i] : order) {
+		WalkPoint closest;
+		float closest_dis2 = std::numeric_limits< float >::infinity();
+		uint32_t closest_triangle = -1U;
+		//start from the previous query's triangle, which (for nearby points) lets the search skip most of the tree:
+		if (previous_triangle != -1U) {
+			closest_dis2 = closest_on_triangle(*this, previous_triangle, world_points[i], &closest);
+			closest_triangle = previous_triangle;
+		}
+		search_bvh(*this, world_points[i], &closest, &closest_dis2, &closest_triangle);
+		walk_points[i] = closest;
+		previous_triangle = closest_triangle;
+	}
+}
 
-	// credit Michael (@stroucki) and Jim McCann for fixing default interior case
+WalkPoint WalkMesh::nearest_walk_point_brute_force(glm::vec3 const &world_point) const {
+	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
 
-	glm::vec3 const &dest = to_world_point(start) + step;
-	glm::vec3 const &dest_bary = barycentric_weights(a, b, c, dest);
-	float min_time = std::numeric_limits<float>::infinity();
-	unsigned int min_coord = -1U;
-	
-	auto check_edge = [&min_time, &min_coord](unsigned int const coord, 
-					float const dest, float const source) {
-		if (dest > 0.0f) return;
-		float const time = -source / (dest - source);
-		if (time < min_time) {
-			min_time = time;
-			min_coord = coord;
+	WalkPoint closest;
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+
+	for (uint32_t t = 0; t < triangles.size(); ++t) {
+		WalkPoint wp;
+		float dis2 = closest_on_triangle(*this, t, world_point, &wp);
+		if (dis2 < closest_dis2) {
+			closest_dis2 = dis2;
+			closest = wp;
 		}
+	}
+	assert(closest.indices.x < vertices.size());
+	assert(closest.indices.y < vertices.size());
+	assert(closest.indices.z < vertices.size());
+	return closest;
+}
+
+//----------------------------------------------------------------
+//casts:
+
+//closest hit found (so far) by a cast:
+struct CastHit {
+	float t; //distance along the (unit) direction; starts at the cast's maximum distance
+	uint32_t triangle = -1U;
+	float u = 0.0f, v = 0.0f; //weights of the triangle's second and third vertices
+};
+
+//Moller-Trumbore ray/triangle test, updating 'best' if triangle 't' is hit closer (or as close, with a lower index):
+// (written out component-by-component so that ray_casts, which does the same arithmetic in the same order
+//  four rays at a time, gets bit-identical answers)
+static void cast_triangle(WalkMesh const &wm, uint32_t t, glm::vec3 const &o, glm::vec3 const &d, CastHit *best_) {
+	assert(best_);
+	auto &best = *best_;
+
+	glm::uvec3 const &tri = wm.triangles[t];
+	glm::vec3 const &a = wm.vertices[tri.x];
+	glm::vec3 const &b = wm.vertices[tri.y];
+	glm::vec3 const &c = wm.vertices[tri.z];
+	float e1x = b.x - a.x, e1y = b.y - a.y, e1z = b.z - a.z;
+	float e2x = c.x - a.x, e2y = c.y - a.y, e2z = c.z - a.z;
+
+	float px = d.y * e2z - d.z * e2y;
+	float py = d.z * e2x - d.x * e2z;
+	float pz = d.x * e2y - d.y * e2x;
+	float det = e1x * px + e1y * py + e1z * pz;
+	float inv = 1.0f / det;
+
+	float sx = o.x - a.x, sy = o.y - a.y, sz = o.z - a.z;
+	float u = (sx * px + sy * py + sz * pz) * inv;
+	float qx = sy * e1z - sz * e1y;
+	float qy = sz * e1x - sx * e1z;
+	float qz = sx * e1y - sy * e1x;
+	float v = (d.x * qx + d.y * qy + d.z * qz) * inv;
+	float dist = (e2x * qx + e2y * qy + e2z * qz) * inv;
+
+	//(a ray parallel to the triangle has det == 0, and the NaNs that follow fail the other tests)
+	if (det != 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && dist >= 0.0f
+	 && (dist < best.t || (dist == best.t && t < best.triangle))) {
+		best.t = dist;
+		best.triangle = t;
+		best.u = u;
+		best.v = v;
+	}
+}
+
+//walkpoint at a cast's hit (arranged so that weights.z is 0.0 if it is on an edge):
+static WalkPoint cast_hit_point(WalkMesh const &wm, CastHit const &hit) {
+	glm::uvec3 const &tri = wm.triangles[hit.triangle];
+	glm::vec3 weights = glm::vec3(std::max(0.0f, 1.0f - hit.u - hit.v), hit.u, hit.v);
+	if (weights.x == 0.0f) {
+		return WalkPoint(glm::uvec3(tri.y, tri.z, tri.x), glm::vec3(weights.y, weights.z, weights.x), hit.triangle);
+	} else if (weights.y == 0.0f) {
+		return WalkPoint(glm::uvec3(tri.z, tri.x, tri.y), glm::vec3(weights.z, weights.x, weights.y), hit.triangle);
+	} else {
+		return WalkPoint(tri, weights, hit.triangle);
+	}
+}
+
+//1 / direction, for box tests (zero components are nudged so that rays running along a box's side don't make NaNs):
+static glm::vec3 inverse_direction(glm::vec3 const &d) {
+	return glm::vec3(
+		1.0f / (d.x != 0.0f ? d.x : 1e-30f),
+		1.0f / (d.y != 0.0f ? d.y : 1e-30f),
+		1.0f / (d.z != 0.0f ? d.z : 1e-30f)
+	);
+}
+
+//distance at which a ray enters a node's box (NaN if it misses it, so that it fails every comparison -- even with an infinite maximum distance):
+static float box_entry(WalkMesh::BVHNode const &node, glm::vec3 const &o, glm::vec3 const &inv) {
+	glm::vec3 t1 = (node.min - o) * inv;
+	glm::vec3 t2 = (node.max - o) * inv;
+	glm::vec3 t_min = glm::min(t1, t2);
+	glm::vec3 t_max = glm::max(t1, t2);
+	float enter = std::max(std::max(t_min.x, t_min.y), t_min.z);
+	float leave = std::min(std::min(t_max.x, t_max.y), t_max.z);
+	return (enter <= leave && leave >= 0.0f ? enter : std::numeric_limits< float >::quiet_NaN());
+}
+
+//look for triangles hit by the ray closer than best.t (or as close, with a lower index than best.triangle), updating best:
+static void cast_bvh(WalkMesh const &wm, glm::vec3 const &o, glm::vec3 const &d, CastHit *best_) {
+	assert(best_);
+	auto &best = *best_;
+
+	glm::vec3 inv = inverse_direction(d);
+
+	struct Entry {
+		uint32_t node;
+		float enter; //where the ray enters the node's box
 	};
-	
-	check_edge(0, dest_bary.x, start.weights.x);
-	check_edge(1, dest_bary.y, start.weights.y);
-	check_edge(2, dest_bary.z, start.weights.z);
-	
-	time = std::min(1.0f, min_time);
-	
-	glm::vec3 const &weights = start.weights + 
-			time * (dest_bary - start.weights);
-	
+	Entry stack[WalkMesh::BVHMaxDepth + 1];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = Entry{0, box_entry(wm.bvh[0], o, inv)};
+	while (stack_size > 0) {
+		Entry at = stack[--stack_size];
+		//(boxes entered at exactly the closest distance are still visited, in case they hold a lower-numbered triangle)
+		if (!(at.enter <= best.t)) continue;
+		WalkMesh::BVHNode const &node = wm.bvh[at.node];
+		if (node.count != 0) {
+			for (uint32_t i = node.begin; i < node.begin + node.count; ++i) {
+				cast_triangle(wm, wm.bvh_triangles[i], o, d, &best);
+			}
+		} else {
+			//visit the child the ray enters first first (it's pushed last):
+			float first = box_entry(wm.bvh[node.begin], o, inv);
+			float second = box_entry(wm.bvh[node.begin + 1], o, inv);
+			if (first <= second) {
+				stack[stack_size++] = Entry{node.begin + 1, second};
+				stack[stack_size++] = Entry{node.begin, first};
+			} else {
+				stack[stack_size++] = Entry{node.begin, first};
+				stack[stack_size++] = Entry{node.begin + 1, second};
+			}
+		}
+	}
+}
+
+bool WalkMesh::ray_cast(glm::vec3 const &origin, glm::vec3 const &direction, WalkPoint *hit_, float *distance_, float max_distance) const {
+	assert(hit_);
+	auto &hit = *hit_;
+	assert(distance_);
+	auto &distance = *distance_;
+
+	float length = glm::length(direction);
+	if (triangles.empty() || !(length > 0.0f)) return false;
+
+	CastHit best;
+	best.t = max_distance;
+	cast_bvh(*this, origin, direction / length, &best);
+	if (best.triangle == -1U) return false;
+
+	hit = cast_hit_point(*this, best);
+	distance = best.t;
+	return true;
+}
+
+bool WalkMesh::segment_cast(glm::vec3 const &from, glm::vec3 const &to, WalkPoint *hit, float *distance) const {
+	return ray_cast(from, to - from, hit, distance, glm::length(to - from));
+}
+
+bool WalkMesh::drop_cast(glm::vec3 const &from, WalkPoint *hit, float *distance, float max_distance) const {
+	return ray_cast(from, glm::vec3(0.0f, 0.0f, -1.0f), hit, distance, max_distance);
+}
+
+bool WalkMesh::ray_cast_brute_force(glm::vec3 const &origin, glm::vec3 const &direction, WalkPoint *hit_, float *distance_, float max_distance) const {
+	assert(hit_);
+	auto &hit = *hit_;
+	assert(distance_);
+	auto &distance = *distance_;
+
+	float length = glm::length(direction);
+	if (triangles.empty() || !(length > 0.0f)) return false;
+
+	CastHit best;
+	best.t = max_distance;
+	for (uint32_t t = 0; t < triangles.size(); ++t) {
+		cast_triangle(*this, t, origin, direction / length, &best);
+	}
+	if (best.triangle == -1U) return false;
+
+	hit = cast_hit_point(*this, best);
+	distance = best.t;
+	return true;
+}
+
+void WalkMesh::ray_casts(uint32_t count, glm::vec3 const *origins, glm::vec3 const *directions, float const *max_distances, WalkPoint *hits, float *distances) const {
+	assert(count == 0 || (origins && directions && max_distances && hits && distances));
+
+	auto finish = [&](uint32_t i, CastHit const &best) {
+		if (best.triangle == -1U) {
+			hits[i] = WalkPoint();
+			distances[i] = std::numeric_limits< float >::infinity();
+		} else {
+			hits[i] = cast_hit_point(*this, best);
+			distances[i] = best.t;
+		}
+	};
+	if (triangles.empty()) {
+		for (uint32_t i = 0; i < count; ++i) finish(i, CastHit{0.0f});
+		return;
+	}
+
+	//trace rays in Z-order (Morton order) of their origins, so that rays traced together start near each other:
+	std::vector< std::pair< uint32_t, uint32_t > > order;
+	morton_order(bvh[0].min, bvh[0].max, count, origins, &order);
+
+#if defined(WALKMESH_SSE)
+	//Rays go down the BVH in groups of four, with one SSE lane per ray: a node is visited if any ray
+	// in the group enters it before its closest hit so far, and each triangle is tested against all four at once.
+	__m128 const zero = _mm_setzero_ps();
+	__m128 const one = _mm_set1_ps(1.0f);
+	__m128 const infinity = _mm_set1_ps(std::numeric_limits< float >::infinity());
+	__m128 const missed = _mm_set1_ps(std::numeric_limits< float >::quiet_NaN());
+	for (uint32_t g = 0; g < count; g += 4) {
+		//per-lane ray (the last group is filled out with copies of its first ray):
+		uint32_t lane_ray[4];
+		alignas(16) float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], ix[4], iy[4], iz[4], start_t[4];
+		for (uint32_t l = 0; l < 4; ++l) {
+			uint32_t i = lane_ray[l] = order[g + l < count ? g + l : g].second;
+			float length = glm::length(directions[i]);
+			//(as in ray_cast; a ray with no direction can't hit anything)
+			glm::vec3 d = (length > 0.0f ? directions[i] / length : glm::vec3(0.0f));
+			glm::vec3 inv = inverse_direction(d);
+			ox[l] = origins[i].x; oy[l] = origins[i].y; oz[l] = origins[i].z;
+			dx[l] = d.x; dy[l] = d.y; dz[l] = d.z;
+			ix[l] = inv.x; iy[l] = inv.y; iz[l] = inv.z;
+			start_t[l] = (length > 0.0f ? max_distances[i] : -1.0f);
+		}
+		__m128 Ox = _mm_load_ps(ox), Oy = _mm_load_ps(oy), Oz = _mm_load_ps(oz);
+		__m128 Dx = _mm_load_ps(dx), Dy = _mm_load_ps(dy), Dz = _mm_load_ps(dz);
+		__m128 Ix = _mm_load_ps(ix), Iy = _mm_load_ps(iy), Iz = _mm_load_ps(iz);
+
+		//closest hits so far:
+		__m128 T = _mm_load_ps(start_t);
+		__m128i Tri = _mm_set1_epi32(std::numeric_limits< int32_t >::max()); //("no triangle", for the signed comparison below)
+		__m128 U = zero, V = zero;
+
+		//where each ray enters a node's box (NaN for rays that miss it, as in box_entry):
+		auto box_entries = [&](WalkMesh::BVHNode const &node) {
+			__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.x), Ox), Ix);
+			__m128 t2x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.x), Ox), Ix);
+			__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.y), Oy), Iy);
+			__m128 t2y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.y), Oy), Iy);
+			__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.z), Oz), Iz);
+			__m128 t2z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.z), Oz), Iz);
+			__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1x, t2x), _mm_min_ps(t1y, t2y)), _mm_min_ps(t1z, t2z));
+			__m128 leave = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1x, t2x), _mm_max_ps(t1y, t2y)), _mm_max_ps(t1z, t2z));
+			__m128 hit = _mm_and_ps(_mm_cmple_ps(enter, leave), _mm_cmpge_ps(leave, zero));
+			return _mm_or_ps(_mm_and_ps(hit, enter), _mm_andnot_ps(hit, missed));
+		};
+		//nearest entry among the rays that need to visit a box:
+		auto first_entry = [&](__m128 enter) {
+			__m128 m = _mm_or_ps(_mm_and_ps(_mm_cmple_ps(enter, T), enter), _mm_andnot_ps(_mm_cmple_ps(enter, T), infinity));
+			m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+			m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+			return _mm_cvtss_f32(m);
+		};
+
+		struct Entry {
+			__m128 enter;
+			uint32_t node;
+		};
+		Entry stack[WalkMesh::BVHMaxDepth + 1];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = Entry{box_entries(bvh[0]), 0};
+		while (stack_size > 0) {
+			Entry at = stack[--stack_size];
+			if (_mm_movemask_ps(_mm_cmple_ps(at.enter, T)) == 0) continue;
+			BVHNode const &node = bvh[at.node];
+			if (node.count != 0) {
+				for (uint32_t n = node.begin; n < node.begin + node.count; ++n) {
+					uint32_t t = bvh_triangles[n];
+					glm::uvec3 const &tri = triangles[t];
+					glm::vec3 const &a = vertices[tri.x];
+					glm::vec3 const &b = vertices[tri.y];
+					glm::vec3 const &c = vertices[tri.z];
+					__m128 E1x = _mm_set1_ps(b.x - a.x), E1y = _mm_set1_ps(b.y - a.y), E1z = _mm_set1_ps(b.z - a.z);
+					__m128 E2x = _mm_set1_ps(c.x - a.x), E2y = _mm_set1_ps(c.y - a.y), E2z = _mm_set1_ps(c.z - a.z);
+
+					//(same arithmetic as cast_triangle)
+					__m128 px = _mm_sub_ps(_mm_mul_ps(Dy, E2z), _mm_mul_ps(Dz, E2y));
+					__m128 py = _mm_sub_ps(_mm_mul_ps(Dz, E2x), _mm_mul_ps(Dx, E2z));
+					__m128 pz = _mm_sub_ps(_mm_mul_ps(Dx, E2y), _mm_mul_ps(Dy, E2x));
+					__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(E1x, px), _mm_mul_ps(E1y, py)), _mm_mul_ps(E1z, pz));
+					__m128 inv = _mm_div_ps(one, det);
+
+					__m128 sx = _mm_sub_ps(Ox, _mm_set1_ps(a.x));
+					__m128 sy = _mm_sub_ps(Oy, _mm_set1_ps(a.y));
+					__m128 sz = _mm_sub_ps(Oz, _mm_set1_ps(a.z));
+					__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+					__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, E1z), _mm_mul_ps(sz, E1y));
+					__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, E1x), _mm_mul_ps(sx, E1z));
+					__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, E1y), _mm_mul_ps(sy, E1x));
+					__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Dx, qx), _mm_mul_ps(Dy, qy)), _mm_mul_ps(Dz, qz)), inv);
+					__m128 dist = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(E2x, qx), _mm_mul_ps(E2y, qy)), _mm_mul_ps(E2z, qz)), inv);
+
+					__m128 ok = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+					ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmple_ps(_mm_add_ps(u, v), one), _mm_cmpge_ps(dist, zero)));
+					__m128i Index = _mm_set1_epi32(int32_t(t));
+					__m128 closer = _mm_or_ps(_mm_cmplt_ps(dist, T), _mm_and_ps(_mm_cmpeq_ps(dist, T), _mm_castsi128_ps(_mm_cmplt_epi32(Index, Tri))));
+					__m128 take = _mm_and_ps(ok, closer);
+					if (_mm_movemask_ps(take) == 0) continue;
+					__m128i take_i = _mm_castps_si128(take);
+					T = _mm_or_ps(_mm_and_ps(take, dist), _mm_andnot_ps(take, T));
+					Tri = _mm_or_si128(_mm_and_si128(take_i, Index), _mm_andnot_si128(take_i, Tri));
+					U = _mm_or_ps(_mm_and_ps(take, u), _mm_andnot_ps(take, U));
+					V = _mm_or_ps(_mm_and_ps(take, v), _mm_andnot_ps(take, V));
+				}
+			} else {
+				//visit the child that some ray enters first first (it's pushed last):
+				__m128 first = box_entries(bvh[node.begin]);
+				__m128 second = box_entries(bvh[node.begin + 1]);
+				if (first_entry(first) <= first_entry(second)) {
+					stack[stack_size++] = Entry{second, node.begin + 1};
+					stack[stack_size++] = Entry{first, node.begin};
+				} else {
+					stack[stack_size++] = Entry{first, node.begin};
+					stack[stack_size++] = Entry{second, node.begin + 1};
+				}
+			}
+		}
+
+		alignas(16) float t[4], u[4], v[4];
+		alignas(16) int32_t tri[4];
+		_mm_store_ps(t, T);
+		_mm_store_si128(reinterpret_cast< __m128i * >(tri), Tri);
+		_mm_store_ps(u, U);
+		_mm_store_ps(v, V);
+		for (uint32_t l = 0; l < 4 && g + l < count; ++l) {
+			CastHit best;
+			best.t = t[l];
+			best.triangle = (tri[l] == std::numeric_limits< int32_t >::max() ? -1U : uint32_t(tri[l]));
+			best.u = u[l];
+			best.v = v[l];
+			finish(lane_ray[l], best);
+		}
+	}
+#else
+	for (auto const &[code, i] : order) {
+		CastHit best;
+		float length = glm::length(directions[i]);
+		best.t = (length > 0.0f ? max_distances[i] : -1.0f);
+		if (length > 0.0f) cast_bvh(*this, origins[i], directions[i] / length, &best);
+		finish(i, best);
+	}
+#endif
+}
+
+
+//arrange 'end' for a step on the triangle of 'start' that stopped at 'weights' and,
+// if min_coord is 0, 1, or 2, reached the edge opposite that vertex (so that end.weights.z is 0.0):
+static void place_step(WalkPoint const &start, glm::vec3 const &weights, uint32_t min_coord, WalkPoint *end_) {
+	assert(end_);
+	auto &end = *end_;
+
+	end.triangle = start.triangle; //(same triangle, whatever the vertex order)
+
 	// Reorder verts (convention)
 	switch(min_coord) {
 		case 0:
@@ -191,6 +747,64 @@ void WalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, W
 	}
 }
 
+//change in the weights of a walkpoint whose first vertex is 'first' (one of 'tri', in some rotation) from taking 'step':
+// (dot products written out, so that walk_batch can do exactly the same arithmetic)
+static glm::vec3 weight_change(glm::uvec3 const &tri, WalkMesh::TriangleData const &data, uint32_t first, glm::vec3 const &step) {
+	float dy = (step.x * data.to_y.x + step.y * data.to_y.y) + step.z * data.to_y.z;
+	float dz = (step.x * data.to_z.x + step.y * data.to_z.y) + step.z * data.to_z.z;
+	float dx = -dy - dz;
+	if (first == tri.x) return glm::vec3(dx, dy, dz);
+	else if (first == tri.y) return glm::vec3(dy, dz, dx);
+	else return glm::vec3(dz, dx, dy);
+}
+
+void WalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end_, float *time_) const {
+	assert(end_);
+	auto &end = *end_;
+
+	assert(time_);
+	auto &time = *time_;
+
+	// credit Michael (@stroucki) and Jim McCann for fixing default interior case
+
+	glm::vec3 dest_bary;
+	if (!triangle_data.empty()) {
+		//weights change linearly with the step, so the destination point isn't needed:
+		uint32_t t = (start.triangle != -1U ? start.triangle : find_half_edge(start) / 3);
+		assert(t < triangles.size());
+		dest_bary = start.weights + weight_change(triangles[t], triangle_data[t], start.indices.x, step);
+	} else {
+		glm::vec3 const &a = vertices[start.indices.x];
+		glm::vec3 const &b = vertices[start.indices.y];
+		glm::vec3 const &c = vertices[start.indices.z];
+		glm::vec3 const &dest = to_world_point(start) + step;
+		dest_bary = barycentric_weights(a, b, c, dest);
+	}
+	float min_time = std::numeric_limits<float>::infinity();
+	unsigned int min_coord = -1U;
+	
+	auto check_edge = [&min_time, &min_coord](unsigned int const coord, 
+					float const dest, float const source) {
+		if (dest > 0.0f) return;
+		float const time = -source / (dest - source);
+		if (time < min_time) {
+			min_time = time;
+			min_coord = coord;
+		}
+	};
+	
+	check_edge(0, dest_bary.x, start.weights.x);
+	check_edge(1, dest_bary.y, start.weights.y);
+	check_edge(2, dest_bary.z, start.weights.z);
+	
+	time = std::min(1.0f, min_time);
+	
+	glm::vec3 const &weights = start.weights + 
+			time * (dest_bary - start.weights);
+
+	place_step(start, weights, min_coord, &end);
+}
+
 bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *rotation_) const {
 	assert(end_);
 	auto &end = *end_;
@@ -201,14 +815,16 @@ bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *ro
 	assert(start.weights.z == 0.0f); //*must* be on an edge.
 
 	//check if 'edge' is a non-boundary edge:
-	auto const f = next_vertex.find(glm::uvec2(start.indices.y, start.indices.x));
-	if (f != next_vertex.end()) {
+	uint32_t h = find_half_edge(start);
+	uint32_t o = (h != -1U ? opposite[h] : -1U);
+	if (o != -1U) {
 		//it is!
 
 		//make 'end' represent the same (world) point, but on triangle (edge.y, edge.x, [other point]):
-		uint32_t const &z = f->second;
+		uint32_t const &z = triangles[o / 3][(o % 3 + 2) % 3];
 		end.indices = glm::uvec3(start.indices.y, start.indices.x, z);
 		end.weights = glm::vec3(start.weights.y, start.weights.x, 0.0f);
+		end.triangle = o / 3;
 
 		//make 'rotation' the rotation that takes (start.indices)'s normal to (end.indices)'s normal:
 		rotation = glm::rotation(start.weights.x * normals[start.indices.x] + start.weights.y * normals[start.indices.y], 
@@ -222,9 +838,301 @@ bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *ro
 	}
 }
 
+//'at' has reached an edge with 'remain' left to walk: step over the edge (turning 'remain' to follow the surface),
+// or, if the edge is a wall, bounce off / slide along it:
+static void leave_edge(WalkMesh const &wm, WalkPoint *at_, glm::vec3 *remain_) {
+	assert(at_);
+	auto &at = *at_;
+	assert(remain_);
+	auto &remain = *remain_;
+
+	WalkPoint end;
+	glm::quat rotation;
+	if (wm.cross_edge(at, &end, &rotation)) {
+		//stepped to a new triangle:
+		at = end;
+		//rotate step to follow surface:
+		remain = rotation * remain;
+	} else {
+		//ran into a wall, bounce / slide along it:
+		glm::vec3 in; //direction into the triangle, away from the wall
+		if (!wm.triangle_data.empty()) {
+			uint32_t h = wm.find_half_edge(at);
+			in = wm.triangle_data[h / 3].inward[h % 3];
+		} else {
+			glm::vec3 const &a = wm.vertices[at.indices.x];
+			glm::vec3 const &b = wm.vertices[at.indices.y];
+			glm::vec3 const &c = wm.vertices[at.indices.z];
+			glm::vec3 along = glm::normalize(b-a);
+			glm::vec3 normal = glm::normalize(glm::cross(b-a, c-a));
+			in = glm::cross(normal, along);
+		}
+
+		//check how much 'remain' is pointing out of the triangle:
+		float d = glm::dot(remain, in);
+		if (d < 0.0f) {
+			//bounce off of the wall:
+			remain += (-1.25f * d) * in;
+		} else {
+			//if it's just pointing along the edge, bend slightly away from wall:
+			remain += 0.01f * d * in;
+		}
+	}
+}
+
+glm::vec3 WalkMesh::walk(WalkPoint *at_, glm::vec3 const &step, uint32_t iterations) const {
+	assert(at_);
+	auto &at = *at_;
+
+	glm::vec3 remain = step;
+	//using a for() instead of a while() here so that if walkpoint gets stuck in
+	// some awkward case, code will not infinite loop:
+	for (uint32_t iter = 0; iter < iterations; ++iter) {
+		if (remain == glm::vec3(0.0f)) break;
+		WalkPoint end;
+		float time;
+		walk_in_triangle(at, remain, &end, &time);
+		at = end;
+		if (time == 1.0f) {
+			//finished within triangle:
+			remain = glm::vec3(0.0f);
+			break;
+		}
+		//some step remains:
+		remain *= (1.0f - time);
+		//try to step over edge:
+		leave_edge(*this, &at, &remain);
+	}
+	return remain;
+}
+
+void WalkMesh::walk_batch(uint32_t count, WalkPoint *at, glm::vec3 *steps, uint32_t const *iterations) const {
+	assert(count == 0 || (at && steps && iterations));
+
+	//Agents are walked in groups of up to Lanes. In each round, every agent in the group that is still walking
+	// does one iteration of walk(): the walk_in_triangle arithmetic runs on structure-of-arrays copies of the
+	// agents' triangles and steps (with no branches, so the compiler can vectorize it), and then each agent
+	// crosses its edge or bounces. The arithmetic is the same as walk_in_triangle's, so the results match walk().
+	constexpr uint32_t Lanes = 256;
+	bool const cached = !triangle_data.empty();
+	struct {
+		//triangle vertices (without triangle_data):
+		float ax[Lanes], ay[Lanes], az[Lanes];
+		float bx[Lanes], by[Lanes], bz[Lanes];
+		float cx[Lanes], cy[Lanes], cz[Lanes];
+		//weight gradients and rotation from the triangle's vertex order to the walkpoint's (with triangle_data):
+		float yx[Lanes], yy[Lanes], yz[Lanes];
+		float zx[Lanes], zy[Lanes], zz[Lanes];
+		uint32_t rotation[Lanes];
+		float wx[Lanes], wy[Lanes], wz[Lanes]; //weights at start of step (in), at end of step (out)
+		float sx[Lanes], sy[Lanes], sz[Lanes]; //step
+		float time[Lanes];
+		uint32_t coord[Lanes]; //edge reached (3 if none)
+	} lane;
+	uint32_t active[Lanes]; //agents (relative to 'base') still walking
+	uint32_t used[Lanes]; //iterations used by each agent (relative to 'base')
+
+	for (uint32_t base = 0; base < count; base += Lanes) {
+		uint32_t group = std::min(Lanes, count - base);
+		uint32_t active_count = 0;
+		for (uint32_t g = 0; g < group; ++g) {
+			used[g] = 0;
+			if (iterations[base + g] > 0 && steps[base + g] != glm::vec3(0.0f)) active[active_count++] = g;
+		}
+
+		while (active_count > 0) {
+			//gather:
+			for (uint32_t k = 0; k < active_count; ++k) {
+				WalkPoint const &wp = at[base + active[k]];
+				glm::vec3 const &step = steps[base + active[k]];
+				if (cached) {
+					uint32_t t = (wp.triangle != -1U ? wp.triangle : find_half_edge(wp) / 3);
+					assert(t < triangles.size());
+					TriangleData const &data = triangle_data[t];
+					lane.yx[k] = data.to_y.x; lane.yy[k] = data.to_y.y; lane.yz[k] = data.to_y.z;
+					lane.zx[k] = data.to_z.x; lane.zy[k] = data.to_z.y; lane.zz[k] = data.to_z.z;
+					lane.rotation[k] = (wp.indices.x == triangles[t].x ? 0 : (wp.indices.x == triangles[t].y ? 1 : 2));
+				} else {
+					glm::vec3 const &a = vertices[wp.indices.x];
+					glm::vec3 const &b = vertices[wp.indices.y];
+					glm::vec3 const &c = vertices[wp.indices.z];
+					lane.ax[k] = a.x; lane.ay[k] = a.y; lane.az[k] = a.z;
+					lane.bx[k] = b.x; lane.by[k] = b.y; lane.bz[k] = b.z;
+					lane.cx[k] = c.x; lane.cy[k] = c.y; lane.cz[k] = c.z;
+				}
+				lane.wx[k] = wp.weights.x; lane.wy[k] = wp.weights.y; lane.wz[k] = wp.weights.z;
+				lane.sx[k] = step.x; lane.sy[k] = step.y; lane.sz[k] = step.z;
+			}
+
+			//walk_in_triangle, for all lanes at once:
+			for (uint32_t k = 0; k < active_count; ++k) {
+				float wx = lane.wx[k], wy = lane.wy[k], wz = lane.wz[k];
+				//barycentric weights of destination:
+				float dx, dy, dz;
+				if (cached) {
+					//(as in weight_change())
+					float sx = lane.sx[k], sy = lane.sy[k], sz = lane.sz[k];
+					float ey = (sx * lane.yx[k] + sy * lane.yy[k]) + sz * lane.yz[k];
+					float ez = (sx * lane.zx[k] + sy * lane.zy[k]) + sz * lane.zz[k];
+					float ex = -ey - ez;
+					uint32_t r = lane.rotation[k];
+					dx = wx + (r == 0 ? ex : (r == 1 ? ey : ez));
+					dy = wy + (r == 0 ? ey : (r == 1 ? ez : ex));
+					dz = wz + (r == 0 ? ez : (r == 1 ? ex : ey));
+				} else {
+					float ax = lane.ax[k], ay = lane.ay[k], az = lane.az[k];
+					//destination (start point + step):
+					float px = ((wx * ax + wy * lane.bx[k]) + wz * lane.cx[k]) + lane.sx[k];
+					float py = ((wx * ay + wy * lane.by[k]) + wz * lane.cy[k]) + lane.sy[k];
+					float pz = ((wx * az + wy * lane.bz[k]) + wz * lane.cz[k]) + lane.sz[k];
+					//(as in barycentric_weights())
+					float v0x = lane.bx[k] - ax, v0y = lane.by[k] - ay, v0z = lane.bz[k] - az;
+					float v1x = lane.cx[k] - ax, v1y = lane.cy[k] - ay, v1z = lane.cz[k] - az;
+					float v2x = px - ax, v2y = py - ay, v2z = pz - az;
+					float d00 = (v0x * v0x + v0y * v0y) + v0z * v0z;
+					float d01 = (v0x * v1x + v0y * v1y) + v0z * v1z;
+					float d11 = (v1x * v1x + v1y * v1y) + v1z * v1z;
+					float d20 = (v2x * v0x + v2y * v0y) + v2z * v0z;
+					float d21 = (v2x * v1x + v2y * v1y) + v2z * v1z;
+					float denom = d00 * d11 - d01 * d01;
+					dy = (d11 * d20 - d01 * d21) / denom;
+					dz = (d00 * d21 - d01 * d20) / denom;
+					dx = 1.0f - dy - dz;
+				}
+				//earliest edge crossed (ties go to the lower coordinate):
+				float inf = std::numeric_limits< float >::infinity();
+				float tx = (dx > 0.0f ? inf : -wx / (dx - wx));
+				float ty = (dy > 0.0f ? inf : -wy / (dy - wy));
+				float tz = (dz > 0.0f ? inf : -wz / (dz - wz));
+				float min_time = inf;
+				uint32_t coord = 3;
+				coord = (tx < min_time ? 0 : coord); min_time = (tx < min_time ? tx : min_time);
+				coord = (ty < min_time ? 1 : coord); min_time = (ty < min_time ? ty : min_time);
+				coord = (tz < min_time ? 2 : coord); min_time = (tz < min_time ? tz : min_time);
+				float time = (min_time < 1.0f ? min_time : 1.0f);
+				lane.time[k] = time;
+				lane.coord[k] = coord;
+				lane.wx[k] = wx + time * (dx - wx);
+				lane.wy[k] = wy + time * (dy - wy);
+				lane.wz[k] = wz + time * (dz - wz);
+			}
+
+			//finish the iteration for each agent, keeping the ones that are still walking:
+			uint32_t still_active = 0;
+			for (uint32_t k = 0; k < active_count; ++k) {
+				uint32_t g = active[k];
+				WalkPoint &wp = at[base + g];
+				glm::vec3 &remain = steps[base + g];
+				WalkPoint end;
+				place_step(wp, glm::vec3(lane.wx[k], lane.wy[k], lane.wz[k]), lane.coord[k], &end);
+				wp = end;
+				used[g] += 1;
+				if (lane.time[k] == 1.0f) {
+					//finished within triangle:
+					remain = glm::vec3(0.0f);
+					continue;
+				}
+				remain *= (1.0f - lane.time[k]);
+				leave_edge(*this, &wp, &remain);
+				if (used[g] < iterations[base + g] && remain != glm::vec3(0.0f)) active[still_active++] = g;
+			}
+			active_count = still_active;
+		}
+	}
+}
+
+void WalkMesh::walk_parallel(WorkerPool &pool, uint32_t count, WalkPoint *at, glm::vec3 *steps, uint32_t const *iterations) const {
+	uint32_t chunks = (count + WalkChunk - 1) / WalkChunk;
+	pool.run(chunks, [&](uint32_t c) {
+		uint32_t begin = c * WalkChunk;
+		walk_batch(std::min(WalkChunk, count - begin), at + begin, steps + begin, iterations + begin);
+	});
+}
+
+uint32_t WalkMesh::find_half_edge(WalkPoint const &wp) const {
+	if (wp.triangle != -1U) {
+		//triangle is known, so just check which of its edges starts at wp.indices.x:
+		glm::uvec3 const &tri = triangles[wp.triangle];
+		uint32_t e = (tri.x == wp.indices.x ? 0 : (tri.y == wp.indices.x ? 1 : 2));
+		assert(tri[e] == wp.indices.x && tri[(e + 1) % 3] == wp.indices.y);
+		return 3 * wp.triangle + e;
+	}
+	//otherwise, look through the half-edges starting at wp.indices.x:
+	for (uint32_t i = vertex_edges_begin[wp.indices.x]; i < vertex_edges_begin[wp.indices.x + 1]; ++i) {
+		uint32_t h = vertex_edges[i];
+		if (triangles[h / 3][(h % 3 + 1) % 3] == wp.indices.y) return h;
+	}
+	return -1U;
+}
 
-WalkMeshes::WalkMeshes(std::string const &filename) {
-	std::ifstream file(filename, std::ios::binary);
+//sort triangles along a Z-order (Morton) curve through their centroids, and renumber vertices in the order the sorted
+// triangles first use them (any unused vertices go last, in their old order):
+static void sort_spatially(std::vector< glm::vec3 > *vertices_, std::vector< glm::vec3 > *normals_, std::vector< glm::uvec3 > *triangles_) {
+	assert(vertices_);
+	auto &vertices = *vertices_;
+	assert(normals_);
+	auto &normals = *normals_;
+	assert(triangles_);
+	auto &triangles = *triangles_;
+	assert(normals.size() == vertices.size());
+
+	if (triangles.empty()) return;
+
+	glm::vec3 min = glm::vec3(std::numeric_limits< float >::infinity());
+	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+	for (auto const &v : vertices) {
+		min = glm::min(min, v);
+		max = glm::max(max, v);
+	}
+	std::vector< glm::vec3 > centroids;
+	centroids.reserve(triangles.size());
+	for (auto const &tri : triangles) {
+		centroids.emplace_back((vertices[tri.x] + vertices[tri.y] + vertices[tri.z]) / 3.0f);
+	}
+	std::vector< std::pair< uint32_t, uint32_t > > order;
+	morton_order(min, max, uint32_t(triangles.size()), centroids.data(), &order);
+
+	std::vector< uint32_t > renumber(vertices.size(), -1U);
+	std::vector< glm::vec3 > new_vertices, new_normals;
+	new_vertices.reserve(vertices.size());
+	new_normals.reserve(normals.size());
+	auto use = [&](uint32_t v) {
+		if (renumber[v] == -1U) {
+			renumber[v] = uint32_t(new_vertices.size());
+			new_vertices.emplace_back(vertices[v]);
+			new_normals.emplace_back(normals[v]);
+		}
+		return renumber[v];
+	};
+	std::vector< glm::uvec3 > new_triangles;
+	new_triangles.reserve(triangles.size());
+	for (auto const &[code, t] : order) {
+		glm::uvec3 const &tri = triangles[t];
+		//(keeping each triangle's vertex order, so it stays CCW)
+		uint32_t x = use(tri.x);
+		uint32_t y = use(tri.y);
+		uint32_t z = use(tri.z);
+		new_triangles.emplace_back(x, y, z);
+	}
+	for (uint32_t v = 0; v < vertices.size(); ++v) {
+		use(v);
+	}
+
+	vertices = std::move(new_vertices);
+	normals = std::move(new_normals);
+	triangles = std::move(new_triangles);
+}
+
+WalkMesh WalkMesh::reordered() const {
+	std::vector< glm::vec3 > new_vertices = vertices;
+	std::vector< glm::vec3 > new_normals = normals;
+	std::vector< glm::uvec3 > new_triangles = triangles;
+	sort_spatially(&new_vertices, &new_normals, &new_triangles);
+	return WalkMesh(new_vertices, new_normals, new_triangles, !triangle_data.empty());
+}
+
+WalkMeshes::WalkMeshes(std::string const &filename, bool reorder) {
+	DataStream file(filename);
 
 	std::vector< glm::vec3 > vertices;
 	read_chunk(file, "p...", &vertices);
@@ -289,6 +1197,8 @@ WalkMeshes::WalkMeshes(std::string const &filename) {
 		
 		std::string name(names.begin() + e.name_begin, names.begin() + e.name_end);
 
+		if (reorder) sort_spatially(&wm_vertices, &wm_normals, &wm_triangles);
+
 		auto ret = meshes.emplace(name, WalkMesh(wm_vertices, wm_normals, wm_triangles));
 		if (!ret.second) {
 			throw std::runtime_error("WalkMesh with duplicated name '" + name + "' in '" + filename + "'");
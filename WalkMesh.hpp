@@ -1,12 +1,13 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <glm/gtx/hash.hpp> //allows the use of 'uvec2' as an unordered_map key
 
 #include <vector>
 #include <string>
 #include <unordered_map>
 
+struct WorkerPool;
+
 //"WalkPoint" represents location on the WalkMesh as barycentric coordinates on a triangle:
 struct WalkPoint {
 	//indices of current triangle (in CCW order):
@@ -14,7 +15,10 @@ struct WalkPoint {
 	//barycentric coordinates for current point:
 	glm::vec3 weights = glm::vec3(std::numeric_limits< float >::quiet_NaN());
 	//NOTE: by convention, if WalkPoint is on an edge, indices/weights will be arranged so that weights.z will be 0.0.
-	WalkPoint(glm::uvec3 const &indices_, glm::vec3 const &weights_) : indices(indices_), weights(weights_) { }
+	//index of the triangle in WalkMesh::triangles, or -1U if not known:
+	// (WalkMesh functions fill this in, and use it to cross edges without searching)
+	uint32_t triangle = -1U;
+	WalkPoint(glm::uvec3 const &indices_, glm::vec3 const &weights_, uint32_t triangle_ = -1U) : indices(indices_), weights(weights_), triangle(triangle_) { }
 	WalkPoint() = default;
 };
 
@@ -24,16 +28,79 @@ struct WalkMesh {
 	std::vector< glm::vec3 > normals; //normals for interpolated 'up' direction
 	std::vector< glm::uvec3 > triangles; //CCW-oriented
 
-	//This "next vertex" map includes [a,b]->c, [b,c]->a, and [c,a]->b for each triangle (a,b,c), and is useful for checking what's over an edge from a given point:
-	std::unordered_map< glm::uvec2, uint32_t > next_vertex;
-
-	//Construct new WalkMesh and build next_vertex structure:
-	WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_);
+	//Adjacency, by "half-edge": half-edge 3*t+e is edge e of triangle t, where edge 0 runs from triangles[t].x to .y, 1 from .y to .z, and 2 from .z to .x.
+	//opposite[h] is the half-edge running the other way along the same edge (in the neighbouring triangle), or -1U on the boundary:
+	std::vector< uint32_t > opposite;
+	//half-edges starting at vertex v are vertex_edges[vertex_edges_begin[v]] through vertex_edges[vertex_edges_begin[v+1]-1]:
+	// (used to find a WalkPoint's triangle when it doesn't know it)
+	std::vector< uint32_t > vertex_edges_begin;
+	std::vector< uint32_t > vertex_edges;
+
+	//Per-triangle data for walking, precomputed from the vertices (unless the mesh was built without it):
+	struct TriangleData {
+		//barycentric weight gradients (edge vectors scaled by the inverse barycentric denominator):
+		// the weight of vertex triangles[t].y at a point p in the plane is dot(p - vertices[triangles[t].x], to_y), and likewise for .z
+		// (so a step changes the weights by dot(step, to_y) and dot(step, to_z), with no need to find the destination point)
+		glm::vec3 to_y;
+		glm::vec3 to_z;
+		glm::vec3 normal; //unit plane normal
+		glm::vec3 inward[3]; //unit vectors in the plane, perpendicular to each edge (numbered as for half-edges), pointing into the triangle
+	};
+	std::vector< TriangleData > triangle_data; //one per triangle, or empty
+
+	//Construct new WalkMesh and build adjacency, BVH, and (if cache_triangles is true) triangle_data:
+	WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_, bool cache_triangles = true);
+
+	//Bounding volume hierarchy over the triangles (built by the constructor; used by nearest_walk_point):
+	struct BVHNode {
+		glm::vec3 min = glm::vec3(std::numeric_limits< float >::infinity());
+		uint32_t begin = 0; //leaf: first entry in bvh_triangles; internal: index of first child (the second child follows it)
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		uint32_t count = 0; //leaf: number of triangles; internal: 0
+	};
+	std::vector< BVHNode > bvh; //bvh[0] is the root
+	std::vector< uint32_t > bvh_triangles; //triangle indices, grouped by leaf
+	static constexpr uint32_t BVHMaxDepth = 48; //(median splits keep the depth near log2(triangles / 4), so this is plenty)
 
 	//used to initialize walking -- finds the closest point on the walk mesh:
-	// (should only need to call this at the start of a level)
+	// (uses the BVH, so it is cheap enough for respawns, teleports, and placing NPCs)
+	//if several triangles are equally close, the lowest-numbered one wins (as in nearest_walk_point_brute_force)
 	WalkPoint nearest_walk_point(glm::vec3 const &world_point) const;
 
+	//nearest_walk_point for many points at once (faster when consecutive points are near each other):
+	void nearest_walk_points(std::vector< glm::vec3 > const &world_points, std::vector< WalkPoint > *walk_points) const;
+
+	//same result as nearest_walk_point, but found by checking every triangle (for testing):
+	WalkPoint nearest_walk_point_brute_force(glm::vec3 const &world_point) const;
+
+	//Casts -- where does a line first meet the walkmesh (from either side of a triangle)?
+	// each returns true if it does, setting *hit (with 'triangle' set) and *distance (from the start, in world units)
+	// (uses the BVH; if several triangles are hit at the same distance, the lowest-numbered one wins)
+	//ray from 'origin' along 'direction' (which need not be unit length), out to 'max_distance':
+	bool ray_cast(glm::vec3 const &origin, glm::vec3 const &direction, WalkPoint *hit, float *distance,
+		float max_distance = std::numeric_limits< float >::infinity()) const;
+	//segment from 'from' to 'to' (for line-of-sight checks, or pulling a camera in from behind a wall):
+	bool segment_cast(glm::vec3 const &from, glm::vec3 const &to, WalkPoint *hit, float *distance) const;
+	//straight down (-z) from 'from' (for dropping things onto the ground):
+	bool drop_cast(glm::vec3 const &from, WalkPoint *hit, float *distance,
+		float max_distance = std::numeric_limits< float >::infinity()) const;
+
+	//ray_cast for many rays at once (same results; rays are traced in groups of four with SSE, which
+	// is faster when rays start near each other and point the same way, e.g., picking or from one camera):
+	// misses set hits[i].triangle to -1U and distances[i] to infinity
+	void ray_casts(
+		uint32_t count,                //[in] number of rays
+		glm::vec3 const *origins,      //[in]
+		glm::vec3 const *directions,   //[in] (need not be unit length)
+		float const *max_distances,    //[in]
+		WalkPoint *hits,               //[out]
+		float *distances               //[out]
+	) const;
+
+	//same result as ray_cast, but found by checking every triangle (for testing):
+	bool ray_cast_brute_force(glm::vec3 const &origin, glm::vec3 const &direction, WalkPoint *hit, float *distance,
+		float max_distance = std::numeric_limits< float >::infinity()) const;
+
 
 	//take a step on a triangle, stopping at edges:
 	//  if the step stays within the triangle:
@@ -64,6 +131,39 @@ struct WalkMesh {
 		glm::quat *rotation     //[out] rotation over edge
 	) const;
 
+	//walk 'step' from *at, crossing edges and bouncing off (sliding along) walls, using at most
+	// 'iterations' walk_in_triangle/cross_edge steps; returns the part of 'step' not taken
+	// (glm::vec3(0.0f) unless the iteration budget ran out):
+	glm::vec3 walk(
+		WalkPoint *at,            //[in,out] location
+		glm::vec3 const &step,    //[in] step to take (in world space)
+		uint32_t iterations = 10  //[in] iteration budget (so a walkpoint stuck in some awkward case can't loop forever)
+	) const;
+
+	//walk many agents at once: the same as calling walk(at + i, steps[i], iterations[i]) for each agent,
+	// but faster for large crowds (the per-triangle arithmetic is done on groups of agents at a time);
+	// walkmesh-bench measures 1.1-1.6x over walk() from 10k to 100k agents on mountain.w. The gain is smallest
+	// for the largest crowds, where both wait on cache misses for each agent's triangle (reordered meshes help there):
+	void walk_batch(
+		uint32_t count,            //[in] number of agents
+		WalkPoint *at,             //[in,out] locations
+		glm::vec3 *steps,          //[in,out] steps to take; replaced with the part of each step not taken
+		uint32_t const *iterations //[in] per-agent iteration budgets
+	) const;
+
+	//walk_batch, spread over the threads of 'pool' (in chunks of WalkChunk agents, each written by only one thread);
+	// every agent walks independently, so the results are the same however many threads there are:
+	static constexpr uint32_t WalkChunk = 1024; //(a multiple of 16 agents, so chunks of 'at' and 'steps' start on cache line boundaries)
+	void walk_parallel(WorkerPool &pool, uint32_t count, WalkPoint *at, glm::vec3 *steps, uint32_t const *iterations) const;
+
+	//copy of this mesh with triangles sorted along a Z-order (Morton) curve through their centroids, and vertices numbered
+	// in the order the sorted triangles first use them, so that triangles near each other on the surface are (mostly) near
+	// each other in memory -- same surface, but walkpoints and triangle indices don't carry over:
+	WalkMesh reordered() const;
+
+	//half-edge running from wp.indices.x to wp.indices.y (or -1U if there is none):
+	uint32_t find_half_edge(WalkPoint const &wp) const;
+
 	//used to read back results of walking:
 	glm::vec3 to_world_point(WalkPoint const &wp) const {
 		//if you were looking here for the lesson solution, well, here you go:
@@ -84,6 +184,7 @@ struct WalkMesh {
 
 	//read back a triangle normal at a walkpoint:
 	glm::vec3 to_world_triangle_normal(WalkPoint const &wp) const {
+		if (wp.triangle != -1U && !triangle_data.empty()) return triangle_data[wp.triangle].normal;
 		glm::vec3 const &a = vertices[wp.indices.x];
 		glm::vec3 const &b = vertices[wp.indices.y];
 		glm::vec3 const &c = vertices[wp.indices.z];
@@ -94,7 +195,9 @@ struct WalkMesh {
 
 struct WalkMeshes {
 	//load a list of named WalkMeshes from a file:
-	WalkMeshes(std::string const &filename);
+	// if 'reorder' is true, each mesh is stored in spatial order (see WalkMesh::reordered()); this renumbers triangles
+	// and vertices, and only pays off for large crowds (walkmesh-bench), so it is off unless asked for
+	WalkMeshes(std::string const &filename, bool reorder = false);
 
 	//retrieve a WalkMesh by name:
 	WalkMesh const &lookup(std::string const &name) const;
@@ -0,0 +1,524 @@
+#include "WalkPaths.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <cassert>
+#include <limits>
+
+WalkPaths::WalkPaths(WalkMesh const &walkmesh_, uint32_t cache_size_) : walkmesh(walkmesh_), cache_size(cache_size_) {
+}
+
+//index of the triangle a walkpoint is on (-1U if it isn't on one):
+static uint32_t triangle_of(WalkMesh const &wm, WalkPoint const &wp) {
+	if (wp.triangle != -1U) return wp.triangle;
+	uint32_t h = wm.find_half_edge(wp);
+	return (h == -1U ? -1U : h / 3);
+}
+
+bool WalkPaths::search(uint32_t start_triangle, WalkPoint const &start, uint32_t goal_triangle, WalkPoint const &goal, std::vector< uint32_t > *exits_, uint32_t *expanded_) const {
+	assert(exits_);
+	auto &exits = *exits_;
+	assert(expanded_);
+	auto &expanded = *expanded_;
+
+	WalkMesh const &wm = walkmesh;
+	uint32_t count = uint32_t(wm.triangles.size());
+
+	//per-thread search state, so that searches on different threads don't interfere (and don't allocate, after the first):
+	// a triangle's entries are only valid when visit[t] == generation, so nothing needs clearing between searches
+	struct Scratch {
+		std::vector< uint32_t > visit; //generation in which 'cost', 'at', and 'from' were set
+		std::vector< uint32_t > closed; //generation in which the triangle was expanded
+		std::vector< float > cost; //best known distance from start
+		std::vector< glm::vec3 > at; //where the search enters the triangle (midpoint of the edge crossed, or the start point)
+		std::vector< uint32_t > from; //half-edge crossed to get here (-1U for the start triangle)
+		std::vector< std::pair< float, uint32_t > > open; //heap of (cost + heuristic, triangle)
+		uint32_t generation = 0;
+	};
+	static thread_local Scratch scratch;
+	if (scratch.visit.size() < count) {
+		scratch.visit.assign(count, 0);
+		scratch.closed.assign(count, 0);
+		scratch.cost.resize(count);
+		scratch.at.resize(count);
+		scratch.from.resize(count);
+		scratch.generation = 0;
+	}
+	scratch.generation += 1;
+	if (scratch.generation == 0) { //(wrapped around, so old marks could look current)
+		std::fill(scratch.visit.begin(), scratch.visit.end(), 0);
+		std::fill(scratch.closed.begin(), scratch.closed.end(), 0);
+		scratch.generation = 1;
+	}
+	uint32_t const generation = scratch.generation;
+
+	//heuristic is the straight-line distance to the goal, which never over-estimates
+	// (costs are straight-line distances between points along the way):
+	glm::vec3 goal_point = wm.to_world_point(goal);
+	auto heuristic = [&goal_point](glm::vec3 const &pt) {
+		return glm::length(goal_point - pt);
+	};
+	auto &open = scratch.open;
+	open.clear();
+	auto push = [&open](float estimate, uint32_t t) {
+		open.emplace_back(estimate, t);
+		std::push_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+	};
+
+	scratch.visit[start_triangle] = generation;
+	scratch.cost[start_triangle] = 0.0f;
+	scratch.at[start_triangle] = wm.to_world_point(start);
+	scratch.from[start_triangle] = -1U;
+	push(heuristic(scratch.at[start_triangle]), start_triangle);
+
+	expanded = 0;
+	bool found = false;
+	while (!open.empty()) {
+		std::pop_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+		uint32_t t = open.back().second;
+		open.pop_back();
+		if (scratch.closed[t] == generation) continue; //(stale entry; triangle was already reached more cheaply)
+		scratch.closed[t] = generation;
+		expanded += 1;
+
+		if (t == goal_triangle) {
+			found = true;
+			break;
+		}
+
+		glm::uvec3 const &tri = wm.triangles[t];
+		for (uint32_t e = 0; e < 3; ++e) {
+			uint32_t o = wm.opposite[3 * t + e];
+			if (o == -1U) continue; //boundary
+			uint32_t n = o / 3;
+			if (scratch.closed[n] == generation) continue;
+			glm::vec3 mid = 0.5f * (wm.vertices[tri[e]] + wm.vertices[tri[(e + 1) % 3]]);
+			float cost = scratch.cost[t] + glm::length(mid - scratch.at[t]);
+			if (scratch.visit[n] != generation || cost < scratch.cost[n]) {
+				scratch.visit[n] = generation;
+				scratch.cost[n] = cost;
+				scratch.at[n] = mid;
+				scratch.from[n] = 3 * t + e;
+				push(cost + heuristic(mid), n);
+			}
+		}
+	}
+	if (!found) return false;
+
+	//read back the edges crossed:
+	exits.clear();
+	for (uint32_t t = goal_triangle; scratch.from[t] != -1U; t = scratch.from[t] / 3) {
+		exits.emplace_back(scratch.from[t]);
+	}
+	std::reverse(exits.begin(), exits.end());
+	return true;
+}
+
+//shortest path from start to goal through a corridor of triangles, using the "simple stupid funnel algorithm"
+// (as described by Mikko Mononen) on the corridor unfolded flat:
+static void pull_string(WalkMesh const &wm, WalkPoint const &start, WalkPoint const &goal, std::vector< uint32_t > const &triangles, std::vector< uint32_t > const &exits, WalkPath *path_) {
+	assert(path_);
+	auto &path = *path_;
+	assert(triangles.size() == exits.size() + 1);
+
+	//place 'r' in the plane, on the left of the (already placed) edge p -> q, keeping its distances to p and q:
+	auto place = [](glm::vec2 const &p2, glm::vec2 const &q2, glm::vec3 const &p, glm::vec3 const &q, glm::vec3 const &r) {
+		glm::vec3 edge = q - p;
+		float edge_length = glm::length(edge);
+		float along = glm::dot(r - p, edge) / edge_length;
+		float height = glm::length(glm::cross(edge, r - p)) / edge_length;
+		glm::vec2 dir = (q2 - p2) / glm::length(q2 - p2);
+		return p2 + dir * along + glm::vec2(-dir.y, dir.x) * height;
+	};
+	//position of a walkpoint, given the positions of its triangle's vertices:
+	auto place_point = [](WalkPoint const &wp, glm::uvec3 const &tri, glm::vec2 const (&pos)[3]) {
+		glm::vec2 ret = glm::vec2(0.0f);
+		for (uint32_t j = 0; j < 3; ++j) {
+			uint32_t k = (tri.x == wp.indices[j] ? 0 : (tri.y == wp.indices[j] ? 1 : 2));
+			ret += wp.weights[j] * pos[k];
+		}
+		return ret;
+	};
+
+	//Unfold the corridor: the first triangle is laid flat (counter-clockwise), and each next one is
+	// hinged down flat over the edge it shares with the one before.
+	//Portal i (for 1 <= i <= exits.size()) is the edge crossed when leaving triangles[i-1]; looking
+	// along the path, its 'left' end is the second vertex of that half-edge and its 'right' end the first.
+	//The start and goal are portals with both ends at the same point.
+	struct Portal {
+		glm::vec2 left, right;
+		uint32_t left_vertex, right_vertex; //(-1U for start and goal)
+	};
+	std::vector< Portal > portals;
+	portals.reserve(exits.size() + 2);
+
+	glm::vec2 pos[3]; //positions of triangles[i]'s vertices
+	glm::uvec3 tri = wm.triangles[triangles[0]];
+	pos[0] = glm::vec2(0.0f);
+	pos[1] = glm::vec2(glm::length(wm.vertices[tri.y] - wm.vertices[tri.x]), 0.0f);
+	pos[2] = place(pos[0], pos[1], wm.vertices[tri.x], wm.vertices[tri.y], wm.vertices[tri.z]);
+	glm::vec2 start2 = place_point(start, tri, pos);
+	portals.emplace_back(Portal{start2, start2, -1U, -1U});
+
+	for (uint32_t h : exits) {
+		uint32_t e = h % 3;
+		uint32_t p = tri[e], q = tri[(e + 1) % 3];
+		portals.emplace_back(Portal{pos[(e + 1) % 3], pos[e], q, p});
+
+		//move to the next triangle (which has the edge as q -> p):
+		uint32_t o = wm.opposite[h];
+		glm::vec2 p2 = pos[e], q2 = pos[(e + 1) % 3];
+		tri = wm.triangles[o / 3];
+		uint32_t f = o % 3;
+		pos[f] = q2;
+		pos[(f + 1) % 3] = p2;
+		pos[(f + 2) % 3] = place(q2, p2, wm.vertices[q], wm.vertices[p], wm.vertices[tri[(f + 2) % 3]]);
+	}
+	glm::vec2 goal2 = place_point(goal, tri, pos);
+	portals.emplace_back(Portal{goal2, goal2, -1U, -1U});
+
+	//Funnel: sweep through the portals, narrowing a funnel (apex, left, right) that holds the straight line
+	// from the apex; when one side crosses the other, the path must bend around that side's end:
+	struct Corner {
+		uint32_t portal;
+		uint32_t vertex; //-1U for start and goal
+		glm::vec2 at;
+	};
+	std::vector< Corner > corners;
+	corners.emplace_back(Corner{0, -1U, start2});
+	//(twice the area of triangle a,b,c; positive when c is clockwise from b, as seen from a)
+	auto area2 = [](glm::vec2 const &a, glm::vec2 const &b, glm::vec2 const &c) {
+		return (c.x - a.x) * (b.y - a.y) - (b.x - a.x) * (c.y - a.y);
+	};
+	//when portals fan around the apex's vertex, the funnel can close on that same vertex again; rather than repeat the
+	// corner, move it to the later portal (so its walkpoint goes on the triangle the path leaves it by):
+	auto add_corner = [&corners](Corner const &corner) {
+		if (corner.at == corners.back().at) corners.back().portal = corner.portal;
+		else corners.emplace_back(corner);
+	};
+	Corner apex = corners.back(), left = apex, right = apex;
+	for (uint32_t i = 1; i < portals.size(); ++i) {
+		Portal const &portal = portals[i];
+		//narrow the right side:
+		if (area2(apex.at, right.at, portal.right) <= 0.0f) {
+			if (apex.at == right.at || area2(apex.at, left.at, portal.right) > 0.0f) {
+				right = Corner{i, portal.right_vertex, portal.right};
+			} else {
+				//right side crossed the left, so the path bends around the left end:
+				add_corner(left);
+				apex = right = left;
+				i = apex.portal;
+				continue;
+			}
+		}
+		//narrow the left side:
+		if (area2(apex.at, left.at, portal.left) >= 0.0f) {
+			if (apex.at == left.at || area2(apex.at, right.at, portal.left) < 0.0f) {
+				left = Corner{i, portal.left_vertex, portal.left};
+			} else {
+				//left side crossed the right, so the path bends around the right end:
+				add_corner(right);
+				apex = left = right;
+				i = apex.portal;
+				continue;
+			}
+		}
+	}
+	//(funnel may already have closed on the goal itself)
+	if (corners.back().portal != portals.size() - 1) {
+		corners.emplace_back(Corner{uint32_t(portals.size() - 1), -1U, goal2});
+	}
+
+	//Read back walkpoints: each corner, and where the straight line from each corner to the next crosses the edges between them:
+	path.points.clear();
+	//(the line can cross an edge exactly at the start, the goal, or a corner; rather than repeat a point, keep the later
+	// one, which is further along the corridor -- except for the start, which stays first)
+	auto add_point = [&wm, &path](WalkPoint const &wp) {
+		if (path.points.empty() || wm.to_world_point(wp) != wm.to_world_point(path.points.back())) path.points.emplace_back(wp);
+		else if (path.points.size() > 1) path.points.back() = wp;
+	};
+	for (uint32_t c = 0; c + 1 < corners.size(); ++c) {
+		Corner const &a = corners[c];
+		Corner const &b = corners[c + 1];
+		if (c == 0) {
+			path.points.emplace_back(start);
+		} else {
+			//corner is a vertex; put it on the triangle after the portal it was found at:
+			uint32_t t = triangles[a.portal];
+			glm::uvec3 const &t_tri = wm.triangles[t];
+			uint32_t k = (t_tri.x == a.vertex ? 0 : (t_tri.y == a.vertex ? 1 : 2));
+			add_point(WalkPoint(glm::uvec3(t_tri[k], t_tri[(k + 1) % 3], t_tri[(k + 2) % 3]), glm::vec3(1.0f, 0.0f, 0.0f), t));
+		}
+		for (uint32_t i = a.portal + 1; i < b.portal; ++i) {
+			Portal const &portal = portals[i];
+			//(line passes through an end of this portal at a corner, which is already in the path)
+			if (a.vertex != -1U && (a.vertex == portal.left_vertex || a.vertex == portal.right_vertex)) continue;
+			if (b.vertex != -1U && (b.vertex == portal.left_vertex || b.vertex == portal.right_vertex)) continue;
+			//where the line a -> b crosses right -> left:
+			glm::vec2 ab = b.at - a.at;
+			glm::vec2 edge = portal.left - portal.right;
+			glm::vec2 ar = a.at - portal.right;
+			float s = (ar.x * ab.y - ar.y * ab.x) / (edge.x * ab.y - edge.y * ab.x);
+			if (!(s >= 0.0f)) s = 0.0f; //(also catches NaN from a parallel line, which shouldn't happen)
+			if (s > 1.0f) s = 1.0f;
+			uint32_t h = exits[i - 1];
+			glm::uvec3 const &h_tri = wm.triangles[h / 3];
+			uint32_t e = h % 3;
+			add_point(WalkPoint(glm::uvec3(h_tri[e], h_tri[(e + 1) % 3], h_tri[(e + 2) % 3]), glm::vec3(1.0f - s, s, 0.0f), h / 3));
+		}
+	}
+	//(goal is always last, even if it is in the same place as the start)
+	if (path.points.size() > 1 && wm.to_world_point(goal) == wm.to_world_point(path.points.back())) path.points.back() = goal;
+	else path.points.emplace_back(goal);
+
+	path.length = 0.0f;
+	for (uint32_t i = 1; i < path.points.size(); ++i) {
+		path.length += glm::length(wm.to_world_point(path.points[i]) - wm.to_world_point(path.points[i-1]));
+	}
+}
+
+bool WalkPaths::find(WalkPoint const &start_, WalkPoint const &goal_, WalkPath *path_) {
+	assert(path_);
+	auto &path = *path_;
+	path = WalkPath();
+
+	uint32_t start_triangle = triangle_of(walkmesh, start_);
+	uint32_t goal_triangle = triangle_of(walkmesh, goal_);
+	if (start_triangle == -1U || goal_triangle == -1U) return false;
+	WalkPoint start = start_;
+	start.triangle = start_triangle;
+	WalkPoint goal = goal_;
+	goal.triangle = goal_triangle;
+
+	//find corridor (in the cache or by searching):
+	std::vector< uint32_t > exits;
+	uint64_t key = (uint64_t(start_triangle) << 32) | uint64_t(goal_triangle);
+	bool cached = false;
+	if (cache_size > 0) {
+		std::unique_lock< std::mutex > lock(cache_mutex);
+		auto f = cache_index.find(key);
+		if (f != cache_index.end()) {
+			cache.splice(cache.begin(), cache, f->second); //(now most recently used)
+			exits = f->second->second;
+			cached = true;
+		}
+	}
+	if (!cached) {
+		if (!search(start_triangle, start, goal_triangle, goal, &exits, &path.expanded)) return false;
+		if (cache_size > 0) {
+			std::unique_lock< std::mutex > lock(cache_mutex);
+			if (cache_index.find(key) == cache_index.end()) { //(another thread may have found the same corridor meanwhile)
+				cache.emplace_front(key, exits);
+				cache_index.emplace(key, cache.begin());
+				if (cache.size() > cache_size) {
+					cache_index.erase(cache.back().first);
+					cache.pop_back();
+				}
+			}
+		}
+	}
+
+	path.triangles.reserve(exits.size() + 1);
+	path.triangles.emplace_back(start_triangle);
+	for (uint32_t h : exits) {
+		path.triangles.emplace_back(walkmesh.opposite[h] / 3);
+	}
+
+	pull_string(walkmesh, start, goal, path.triangles, exits, &path);
+	return true;
+}
+
+void WalkPaths::clear_cache() {
+	std::unique_lock< std::mutex > lock(cache_mutex);
+	cache.clear();
+	cache_index.clear();
+}
+
+//----------------------------------------------------------------
+//flow fields:
+
+glm::vec3 FlowField::direction(WalkMesh const &walkmesh, WalkPoint const &at) const {
+	uint32_t t = triangle_of(walkmesh, at);
+	if (t == -1U) return glm::vec3(0.0f);
+	if (next[t] != -1U || nearest[t] == -1U) return directions[t];
+	//on the goal's triangle, so head straight for it:
+	glm::vec3 to = walkmesh.to_world_point(goals[nearest[t]]) - walkmesh.to_world_point(at);
+	float length = glm::length(to);
+	return (length > 0.0f ? to / length : glm::vec3(0.0f));
+}
+
+FlowFields::FlowFields(WalkMesh const &walkmesh_, uint32_t cache_size_) : walkmesh(walkmesh_), cache_size(std::max(1U, cache_size_)) {
+	std::vector< glm::vec3 > centers;
+	centers.reserve(walkmesh.triangles.size());
+	for (auto const &tri : walkmesh.triangles) {
+		centers.emplace_back((walkmesh.vertices[tri.x] + walkmesh.vertices[tri.y] + walkmesh.vertices[tri.z]) / 3.0f);
+	}
+
+	crossing_cost.assign(walkmesh.opposite.size(), std::numeric_limits< float >::infinity());
+	crossing_direction.assign(walkmesh.opposite.size(), glm::vec3(0.0f));
+	for (uint32_t h = 0; h < walkmesh.opposite.size(); ++h) {
+		glm::uvec3 const &tri = walkmesh.triangles[h / 3];
+		glm::vec3 mid = 0.5f * (walkmesh.vertices[tri[h % 3]] + walkmesh.vertices[tri[(h % 3 + 1) % 3]]);
+		glm::vec3 out = mid - centers[h / 3];
+		float length = glm::length(out);
+		if (length > 0.0f) crossing_direction[h] = out / length;
+		uint32_t o = walkmesh.opposite[h];
+		if (o != -1U) crossing_cost[h] = length + glm::length(centers[o / 3] - mid);
+	}
+	//(make costs exactly symmetric, so it doesn't matter which way they are read)
+	for (uint32_t h = 0; h < walkmesh.opposite.size(); ++h) {
+		uint32_t o = walkmesh.opposite[h];
+		if (o != -1U && o < h) crossing_cost[h] = crossing_cost[o];
+	}
+}
+
+//are two goals the same point?
+static bool same_goal(WalkPoint const &a, WalkPoint const &b) {
+	return a.triangle == b.triangle && a.indices == b.indices && a.weights == b.weights;
+}
+
+void FlowFields::update(FlowField *field_, std::vector< WalkPoint > const &goals_) const {
+	assert(field_);
+	auto &field = *field_;
+
+	WalkMesh const &wm = walkmesh;
+	uint32_t count = uint32_t(wm.triangles.size());
+	if (field.distances.size() != count) {
+		field.goals.clear();
+		field.distances.assign(count, std::numeric_limits< float >::infinity());
+		field.directions.assign(count, glm::vec3(0.0f));
+		field.next.assign(count, -1U);
+		field.nearest.assign(count, -1U);
+	}
+
+	std::vector< WalkPoint > goals = goals_;
+	for (auto &goal : goals) {
+		goal.triangle = triangle_of(wm, goal);
+	}
+
+	//match up old goals with new ones:
+	std::vector< uint32_t > kept(field.goals.size(), -1U); //old goal index -> new goal index
+	std::vector< bool > added(goals.size(), true);
+	for (uint32_t i = 0; i < field.goals.size(); ++i) {
+		for (uint32_t j = 0; j < goals.size(); ++j) {
+			if (added[j] && same_goal(field.goals[i], goals[j])) {
+				kept[i] = j;
+				added[j] = false;
+				break;
+			}
+		}
+	}
+	field.goals = std::move(goals);
+
+	//forget the way everywhere a removed goal was nearest:
+	std::vector< uint32_t > lost;
+	for (uint32_t t = 0; t < count; ++t) {
+		if (field.nearest[t] == -1U) continue;
+		field.nearest[t] = kept[field.nearest[t]];
+		if (field.nearest[t] == -1U) {
+			field.distances[t] = std::numeric_limits< float >::infinity();
+			field.directions[t] = glm::vec3(0.0f);
+			field.next[t] = -1U;
+			lost.emplace_back(t);
+		}
+	}
+
+	//Dijkstra's algorithm, from every triangle given a shorter distance:
+	std::vector< std::pair< float, uint32_t > > open; //heap of (distance, triangle)
+	auto improve = [&](uint32_t t, float distance, uint32_t next, glm::vec3 const &direction, uint32_t nearest) {
+		if (!(distance < field.distances[t])) return;
+		field.distances[t] = distance;
+		field.directions[t] = direction;
+		field.next[t] = next;
+		field.nearest[t] = nearest;
+		open.emplace_back(distance, t);
+		std::push_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+	};
+
+	//start from the goals (including kept ones, which may now be nearest to lost triangles on their own triangle):
+	for (uint32_t j = 0; j < field.goals.size(); ++j) {
+		uint32_t t = field.goals[j].triangle;
+		if (t == -1U) continue;
+		glm::uvec3 const &tri = wm.triangles[t];
+		glm::vec3 center = (wm.vertices[tri.x] + wm.vertices[tri.y] + wm.vertices[tri.z]) / 3.0f;
+		improve(t, glm::length(wm.to_world_point(field.goals[j]) - center), -1U, glm::vec3(0.0f), j);
+	}
+	//...and from the edges of the lost region:
+	for (uint32_t t : lost) {
+		for (uint32_t h = 3 * t; h < 3 * t + 3; ++h) {
+			uint32_t o = wm.opposite[h];
+			if (o == -1U || field.nearest[o / 3] == -1U) continue;
+			improve(t, field.distances[o / 3] + crossing_cost[h], h, crossing_direction[h], field.nearest[o / 3]);
+		}
+	}
+
+	field.touched = 0;
+	while (!open.empty()) {
+		std::pop_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+		auto [distance, t] = open.back();
+		open.pop_back();
+		if (distance > field.distances[t]) continue; //(stale entry; triangle was since reached more cheaply)
+		field.touched += 1;
+		for (uint32_t h = 3 * t; h < 3 * t + 3; ++h) {
+			uint32_t o = wm.opposite[h];
+			if (o == -1U) continue;
+			//neighbour reaches the goal by crossing back over this edge:
+			improve(o / 3, distance + crossing_cost[o], o, crossing_direction[o], field.nearest[t]);
+		}
+	}
+}
+
+FlowField const &FlowFields::field(std::vector< WalkPoint > const &goals_) {
+	std::vector< WalkPoint > goals = goals_;
+	for (auto &goal : goals) {
+		goal.triangle = triangle_of(walkmesh, goal);
+	}
+
+	//how many goals are in one set but not the other?
+	auto difference = [&goals](FlowField const &field) {
+		uint32_t shared = 0;
+		std::vector< bool > used(field.goals.size(), false);
+		for (auto const &goal : goals) {
+			for (uint32_t i = 0; i < field.goals.size(); ++i) {
+				if (!used[i] && same_goal(field.goals[i], goal)) {
+					used[i] = true;
+					shared += 1;
+					break;
+				}
+			}
+		}
+		return uint32_t(goals.size() + field.goals.size()) - 2 * shared;
+	};
+
+	//cached field for these goals, or else the one with the most alike goals:
+	auto best = cache.end();
+	uint32_t best_difference = -1U;
+	for (auto f = cache.begin(); f != cache.end(); ++f) {
+		uint32_t d = difference(*f);
+		if (d < best_difference) {
+			best = f;
+			best_difference = d;
+		}
+	}
+	if (best != cache.end() && best_difference == 0) {
+		cache.splice(cache.begin(), cache, best); //(now most recently used)
+		return cache.front();
+	}
+
+	//make room (reusing the least recently used field's storage):
+	if (cache.size() >= cache_size) {
+		cache.splice(cache.begin(), cache, std::prev(cache.end()));
+	} else {
+		cache.emplace_front();
+	}
+	if (best != cache.end() && best != cache.begin()) {
+		cache.front() = *best;
+	}
+	//(if nothing was similar, the field is updated from whatever it had -- removing all the old goals
+	// costs about as much as starting over)
+	update(&cache.front(), goals);
+	return cache.front();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//Routes between points on a WalkMesh:
+// A* over the triangle adjacency graph finds a corridor of triangles from start to goal,
+// then the shortest path through the corridor is found by string-pulling (the "funnel" algorithm)
+// on the corridor unfolded flat, so it follows the surface.
+//Corridors are cached by start and goal triangle, so repeated queries between the same areas skip the search.
+//For many agents heading to the same few goals, FlowFields gives every triangle a direction
+// toward the nearest goal instead, so each agent's step is one lookup.
+
+struct WalkPath {
+	//start, then each place the path bends around a corner or crosses an edge, then goal:
+	// (consecutive points are always on a common triangle, so the path can be followed with WalkMesh::walk, and are never
+	//  in the same place -- unless the start and goal are)
+	std::vector< WalkPoint > points;
+	std::vector< uint32_t > triangles; //corridor, from start to goal triangle
+	float length = 0.0f; //along the surface
+	uint32_t expanded = 0; //triangles expanded by A* (0 if the corridor came from the cache)
+};
+
+struct WalkPaths {
+	//'walkmesh' must outlive this object; 'cache_size' is the number of corridors kept (0 == no cache):
+	WalkPaths(WalkMesh const &walkmesh, uint32_t cache_size = 1024);
+
+	//find a path from 'start' to 'goal'; returns false (and clears *path) if there is none:
+	// (safe to call from several threads at once)
+	bool find(WalkPoint const &start, WalkPoint const &goal, WalkPath *path);
+
+	//forget cached corridors (e.g., for timing):
+	void clear_cache();
+
+	WalkMesh const &walkmesh;
+
+	//internals:
+	//A* corridor from 'start_triangle' to 'goal_triangle' (exit half-edge of each triangle but the last);
+	// returns false if there is none:
+	bool search(uint32_t start_triangle, WalkPoint const &start, uint32_t goal_triangle, WalkPoint const &goal, std::vector< uint32_t > *exits, uint32_t *expanded) const;
+
+	//least-recently-used cache of corridors (key is start triangle << 32 | goal triangle):
+	uint32_t cache_size;
+	std::mutex cache_mutex;
+	std::list< std::pair< uint64_t, std::vector< uint32_t > > > cache; //most recently used first
+	std::unordered_map< uint64_t, decltype(cache)::iterator > cache_index;
+};
+
+//Direction and distance to the nearest of a set of goals, for every triangle of a walkmesh:
+// (built and updated by FlowFields)
+struct FlowField {
+	std::vector< WalkPoint > goals; //(with 'triangle' set; -1U for goals not on the mesh, which are ignored)
+
+	//per triangle:
+	std::vector< float > distances; //to the nearest goal (infinity if no goal can be reached)
+	std::vector< glm::vec3 > directions; //unit vector toward the next triangle on the way (zero in goal triangles and where no goal can be reached)
+	std::vector< uint32_t > next; //half-edge to cross next (-1U in goal triangles and where no goal can be reached)
+	std::vector< uint32_t > nearest; //index in 'goals' of the goal being walked to (-1U where none can be reached)
+
+	uint32_t touched = 0; //triangles settled by the last build or update (for measuring)
+
+	//direction to walk from 'at' (unit length; zero if 'at' is on a goal or no goal can be reached):
+	// (just directions[at.triangle], except on a goal's triangle, where it heads straight for the goal)
+	glm::vec3 direction(WalkMesh const &walkmesh, WalkPoint const &at) const;
+};
+
+struct FlowFields {
+	//'walkmesh' must outlive this object; 'cache_size' is the number of fields kept (at least one):
+	FlowFields(WalkMesh const &walkmesh, uint32_t cache_size = 8);
+
+	//field for a set of goals (in any order); built on first use by updating the cached field whose
+	// goals are most alike, so adding or removing a goal only re-settles the triangles it changes:
+	// (the reference stays valid until the next call; not safe to call from several threads at once)
+	FlowField const &field(std::vector< WalkPoint > const &goals);
+
+	//change the goals of a field (one not made by this object yet is built from scratch):
+	void update(FlowField *field, std::vector< WalkPoint > const &goals) const;
+
+	WalkMesh const &walkmesh;
+
+	//internals:
+	//per half-edge, for going from the triangle's center to the next one's, through the edge's midpoint:
+	std::vector< float > crossing_cost; //distance (same both ways)
+	std::vector< glm::vec3 > crossing_direction; //direction from the triangle's center to the edge's midpoint
+
+	uint32_t cache_size;
+	std::list< FlowField > cache; //most recently used first
+};
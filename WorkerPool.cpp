@@ -0,0 +1,90 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(uint32_t threads) {
+	if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+	//the thread calling run() also runs jobs, so start one fewer worker:
+	for (uint32_t t = 1; t < threads; ++t) {
+		workers.emplace_back(&WorkerPool::work, this);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+WorkerPool &WorkerPool::shared() {
+	static WorkerPool pool;
+	return pool;
+}
+
+void WorkerPool::run(uint32_t count, std::function< void(uint32_t) > const &job) {
+	if (count == 0) return;
+
+	std::unique_lock< std::mutex > run_lock(run_mutex);
+
+	{ //start batch:
+		std::unique_lock< std::mutex > lock(mutex);
+		batch_job = &job;
+		batch_count = count;
+		batch_error = nullptr;
+		next_job = 0;
+		busy = uint32_t(workers.size());
+		batch += 1;
+	}
+	wake.notify_all();
+
+	run_jobs();
+
+	std::exception_ptr error;
+	{ //wait for workers to finish:
+		std::unique_lock< std::mutex > lock(mutex);
+		done.wait(lock, [this](){ return busy == 0; });
+		batch_job = nullptr;
+		error = batch_error;
+		batch_error = nullptr;
+	}
+
+	if (error) std::rethrow_exception(error);
+}
+
+void WorkerPool::work() {
+	uint32_t seen = 0;
+	while (true) {
+		{ //wait for a new batch (or quit):
+			std::unique_lock< std::mutex > lock(mutex);
+			wake.wait(lock, [this,&seen](){ return quit || batch != seen; });
+			if (quit) return;
+			seen = batch;
+		}
+
+		run_jobs();
+
+		{ //check out of the batch:
+			std::unique_lock< std::mutex > lock(mutex);
+			busy -= 1;
+			if (busy == 0) done.notify_one();
+		}
+	}
+}
+
+void WorkerPool::run_jobs() {
+	while (true) {
+		uint32_t i = next_job.fetch_add(1);
+		if (i >= batch_count) break;
+		try {
+			(*batch_job)(i);
+		} catch (...) {
+			std::unique_lock< std::mutex > lock(mutex);
+			if (!batch_error) batch_error = std::current_exception();
+		}
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+/*
+ * WorkerPool keeps a set of threads around to run batches of independent jobs:
+ *
+ *  pool.run(count, [&](uint32_t i){ ... job i ... });
+ *
+ * run() calls the function once for each i in [0, count), spread over the
+ *  worker threads and the calling thread, and returns once all jobs are done.
+ * If a job throws, the first exception is re-thrown from run().
+ */
+
+struct WorkerPool {
+	//threads == 0 means "one per hardware thread" (counting the thread calling run()):
+	WorkerPool(uint32_t threads = 0);
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator=(WorkerPool const &) = delete;
+
+	void run(uint32_t count, std::function< void(uint32_t) > const &job);
+
+	//number of threads that run jobs (workers + calling thread):
+	uint32_t size() const { return uint32_t(workers.size()) + 1; }
+
+	//pool shared by code that doesn't need its own:
+	static WorkerPool &shared();
+
+	//internals:
+	void work(); //body of each worker thread
+	void run_jobs(); //take jobs from the current batch until there are none left
+
+	std::vector< std::thread > workers;
+
+	std::mutex run_mutex; //only one batch runs at a time
+
+	std::mutex mutex; //protects everything below:
+	std::condition_variable wake; //workers wait for a new batch
+	std::condition_variable done; //run() waits for the batch to finish
+	bool quit = false;
+	uint32_t batch = 0; //incremented for each new batch
+	std::function< void(uint32_t) > const *batch_job = nullptr;
+	uint32_t batch_count = 0;
+	uint32_t busy = 0; //workers still inside the current batch
+	std::exception_ptr batch_error;
+
+	std::atomic< uint32_t > next_job{0}; //next job index to hand out
+};
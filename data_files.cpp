@@ -0,0 +1,152 @@
+#include "data_files.hpp"
+
+#include "data_path.hpp"
+#include "AssetPack.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <mutex>
+
+//when the mounted pack was written (loose files newer than this are re-exports the pack hasn't caught up with):
+static std::filesystem::file_time_type pack_time;
+
+//the pack (if any) is mapped the first time a data file is requested:
+static AssetPack const *get_pack() {
+	static std::unique_ptr< AssetPack > pack;
+	static std::once_flag once;
+	std::call_once(once, [](){
+		std::string filename = data_path("assets.pack");
+		if (!std::filesystem::exists(filename)) return; //no pack; only loose files
+		try {
+			pack = std::make_unique< AssetPack >(filename);
+			pack_time = std::filesystem::last_write_time(filename);
+			std::cout << "Mounted asset pack '" << filename << "' (" << pack->index.size() << " files)." << std::endl;
+		} catch (std::exception const &e) {
+			std::cerr << "WARNING: failed to mount asset pack: " << e.what() << std::endl;
+			pack.reset();
+		}
+	});
+	return pack.get();
+}
+
+//name of a path inside the data directory (as stored in the pack), or false if it isn't inside:
+static bool data_name(std::string const &path, std::string *name_) {
+	assert(name_);
+	auto &name = *name_;
+	static std::string const prefix = data_path("");
+	if (path.compare(0, prefix.size(), prefix) != 0) return false;
+	name = path.substr(prefix.size());
+	return true;
+}
+
+//look up a path in the pack; only paths inside the data directory can be packed:
+static bool find_packed(std::string const &path, char const **data, size_t *size) {
+	AssetPack const *pack = get_pack();
+	if (!pack) return false;
+	std::string name;
+	if (!data_name(path, &name)) return false;
+	return pack->find(name, data, size);
+}
+
+//should a loose copy of 'path' be used instead of the packed one?
+// yes if the loose file is newer than the pack (so a stale pack never hides a re-exported asset; this costs a stat, not an open),
+// or if it is listed in the ASSET_OVERRIDES environment variable (names relative to the data directory, separated by ',', or '*' for every file):
+static bool loose_overrides_pack(std::string const &path) {
+	std::error_code ec;
+	std::filesystem::file_time_type loose_time = std::filesystem::last_write_time(path, ec);
+	if (!ec && loose_time > pack_time) {
+		std::cerr << "WARNING: '" << path << "' is newer than the asset pack, so it is read instead of the packed copy (re-run pack-assets to update the pack)." << std::endl;
+		return true;
+	}
+
+	static std::vector< std::string > const overrides = [](){
+		std::vector< std::string > ret;
+		char const *var = std::getenv("ASSET_OVERRIDES");
+		if (var == nullptr) return ret;
+		std::string list = var;
+		for (size_t begin = 0; begin <= list.size(); ) {
+			size_t end = std::min(list.find(',', begin), list.size());
+			if (end > begin) ret.emplace_back(list.substr(begin, end - begin));
+			begin = end + 1;
+		}
+		if (!ret.empty()) std::cout << "Loose files listed in ASSET_OVERRIDES ('" << list << "') override the asset pack." << std::endl;
+		return ret;
+	}();
+	if (overrides.empty()) return false;
+	if (overrides.size() == 1 && overrides[0] == "*") return true;
+	std::string name;
+	if (!data_name(path, &name)) return false;
+	return std::find(overrides.begin(), overrides.end(), name) != overrides.end();
+}
+
+DataBlob read_data_file(std::string const &path) {
+	DataBlob blob;
+
+	//packed copy is used unless overridden (so no file is opened):
+	bool packed = find_packed(path, &blob.data, &blob.size);
+	if (packed && !loose_overrides_pack(path)) return blob;
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		if (packed) return blob; //override requested, but there is no loose file
+		throw std::runtime_error("Failed to open data file '" + path + "'.");
+	}
+	file.seekg(0, std::ios::end);
+	blob.storage.resize(size_t(file.tellg()));
+	file.seekg(0, std::ios::beg);
+	if (!file.read(blob.storage.data(), blob.storage.size())) {
+		throw std::runtime_error("Failed to read data file '" + path + "'.");
+	}
+	blob.data = blob.storage.data();
+	blob.size = blob.storage.size();
+	return blob;
+}
+
+//------------------------------------------
+
+DataStream::MemoryBuf::MemoryBuf(char const *data, size_t size) {
+	//std::streambuf wants non-const pointers, but the get area is never written through:
+	char *begin = const_cast< char * >(data);
+	setg(begin, begin, begin + size);
+}
+
+DataStream::MemoryBuf::pos_type DataStream::MemoryBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+	if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+	char *target;
+	if (dir == std::ios_base::beg) target = eback() + off;
+	else if (dir == std::ios_base::cur) target = gptr() + off;
+	else target = egptr() + off;
+	if (target < eback() || target > egptr()) return pos_type(off_type(-1));
+	setg(eback(), target, egptr());
+	return pos_type(target - eback());
+}
+
+DataStream::MemoryBuf::pos_type DataStream::MemoryBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+	return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+DataStream::DataStream(std::string const &path) : std::istream(nullptr) {
+	//packed copy is used unless overridden (so no file is opened):
+	char const *data;
+	size_t size;
+	bool packed = find_packed(path, &data, &size);
+	if (!packed || loose_overrides_pack(path)) {
+		std::unique_ptr< std::filebuf > file = std::make_unique< std::filebuf >();
+		if (file->open(path, std::ios::in | std::ios::binary)) {
+			buf = std::move(file);
+		}
+	}
+	if (!buf && packed) {
+		buf = std::make_unique< MemoryBuf >(data, size);
+	}
+
+	if (buf) {
+		rdbuf(buf.get());
+	} else {
+		setstate(std::ios_base::failbit); //same as a std::ifstream that failed to open
+	}
+}
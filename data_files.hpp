@@ -0,0 +1,49 @@
+#pragma once
+
+#include <istream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+
+/*
+ * Access to data files (paths built with data_path()).
+ *
+ * If 'assets.pack' exists next to the executable, it is mapped into memory
+ *  the first time a data file is requested and files are served from it
+ *  without opening any other file. Loose files are read instead for files the
+ *  pack doesn't contain, for files newer than the pack (with a warning, so a
+ *  stale pack never hides re-exported assets), and for files listed in the
+ *  ASSET_OVERRIDES environment variable (comma-separated names relative to
+ *  the data directory, or '*' for all).
+ */
+
+//contents of a data file as a block of memory:
+struct DataBlob {
+	DataBlob() = default;
+	DataBlob(DataBlob &&) = default;
+	DataBlob &operator=(DataBlob &&) = default;
+	DataBlob(DataBlob const &) = delete;
+	DataBlob &operator=(DataBlob const &) = delete;
+
+	char const *data = nullptr;
+	size_t size = 0;
+	//loose files are read into 'storage'; packed files point directly into the mapped pack:
+	std::vector< char > storage;
+};
+
+//read a whole data file; throws on error:
+DataBlob read_data_file(std::string const &path);
+
+//drop-in replacement for std::ifstream when reading data files:
+struct DataStream : std::istream {
+	DataStream(std::string const &path);
+
+	//internals:
+	struct MemoryBuf : std::streambuf {
+		MemoryBuf(char const *data, size_t size);
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+	};
+	std::unique_ptr< std::streambuf > buf;
+};
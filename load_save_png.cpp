@@ -1,34 +1,47 @@
 #include "load_save_png.hpp"
 
+#include "data_files.hpp"
+#include "WorkerPool.hpp"
+
 #include <png.h>
+#include <zlib.h>
 
 #include <iostream>
 #include <fstream>
 #include <cassert>
 #include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <cstdlib>
+#include <memory>
+#include <functional>
 
 #define LOG_ERROR( X ) std::cerr << X << std::endl
 
 using std::vector;
 
-bool load_png(std::istream &from, unsigned int *width, unsigned int *height, vector< glm::u8vec4 > *data, OriginLocation origin);
-void save_png(std::ostream &to, unsigned int width, unsigned int height, glm::u8vec4 const *data, OriginLocation origin);
-
 void load_png(std::string filename, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin) {
 	assert(size);
 
-	std::ifstream file(filename.c_str(), std::ios::binary);
-	if (!file) {
-		throw std::runtime_error("Failed to open PNG image file '" + filename + "'.");
-	}
-	if (!load_png(file, &size->x, &size->y, data, origin)) {
-		throw std::runtime_error("Failed to read PNG image from '" + filename + "'.");
+	//read the whole file (or find it in the asset pack), then decode from memory:
+	DataBlob blob = read_data_file(filename);
+	try {
+		load_png(blob.data, blob.size, size, data, origin);
+	} catch (std::exception &e) {
+		throw std::runtime_error("Failed to read PNG image from '" + filename + "': " + e.what());
 	}
 }
 
-void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin) {
+static void encode_png(glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options, std::function< void(char const *, size_t) > const &write);
+
+void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options) {
 	std::ofstream file(filename.c_str(), std::ios::binary);
-	save_png(file, size.x, size.y, data, origin);
+	encode_png(size, data, origin, options, [&file](char const *bytes, size_t count) {
+		file.write(bytes, count);
+	});
+	if (!file) {
+		LOG_ERROR("Error writing png '" << filename << "'.");
+	}
 }
 
 
@@ -57,23 +70,22 @@ static void user_flush_data(png_structp png_ptr) {
 }
 
 
-bool load_png(std::istream &from, unsigned int *width, unsigned int *height, vector< glm::u8vec4 > *data, OriginLocation origin) {
-	assert(data);
-	uint32_t local_width, local_height;
-	if (width == nullptr) width = &local_width;
-	if (height == nullptr) height = &local_height;
-	*width = *height = 0;
-	data->clear();
-	//..... load file ......
+//shared by all of the loaders:
+// 'read_fn' + 'io' supply the PNG data to libpng;
+// 'allocate' is called once the image size is known, and returns where the first pixel of the
+//   (origin-ordered) image should go and the distance between rows (or nullptr to abort).
+typedef glm::u8vec4 *(*AllocateFn)(void *, glm::uvec2 const &, size_t *);
+static bool decode_png(png_rw_ptr read_fn, void *io, AllocateFn allocate, void *allocate_data, glm::uvec2 *size, OriginLocation origin) {
 	//Load a png file, as per the libpng docs:
 	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, (png_voidp)NULL, (png_error_ptr)NULL, (png_error_ptr)NULL);
 
-	png_set_read_fn(png, &from, user_read_data);
-
 	if (!png) {
 		LOG_ERROR("  cannot alloc read struct.");
 		return false;
 	}
+
+	png_set_read_fn(png, io, read_fn);
+
 	png_infop info = png_create_info_struct(png);
 	if (!info) {
 		LOG_ERROR("  cannot alloc info struct.");
@@ -85,7 +97,6 @@ bool load_png(std::istream &from, unsigned int *width, unsigned int *height, vec
 		LOG_ERROR("  png interal error.");
 		png_destroy_read_struct(&png, &info, (png_infopp)NULL);
 		if (row_pointers != NULL) delete[] row_pointers;
-		data->clear();
 		return false;
 	}
 	//not needed with custom read/write functions: png_init_io(png, NULL);
@@ -109,24 +120,127 @@ bool load_png(std::istream &from, unsigned int *width, unsigned int *height, vec
 	//Make sure it's the format we think it is...
 	assert(rowbytes == w*sizeof(uint32_t));
 
-	data->resize(w*h);
+	size_t stride = 0;
+	glm::u8vec4 *pixels = allocate(allocate_data, glm::uvec2(w, h), &stride);
+	if (!pixels) {
+		png_destroy_read_struct(&png, &info, NULL);
+		return false;
+	}
+
+	//point libpng's rows straight at the destination, in origin order:
 	row_pointers = new png_bytep[h];
 	for (unsigned int r = 0; r < h; ++r) {
 		if (origin == LowerLeftOrigin) {
-			row_pointers[h-1-r] = (png_bytep)(&(*data)[r*w]);
+			row_pointers[h-1-r] = (png_bytep)(pixels + r * stride);
 		} else {
-			row_pointers[r] = (png_bytep)(&(*data)[r*w]);
+			row_pointers[r] = (png_bytep)(pixels + r * stride);
 		}
 	}
 	png_read_image(png, row_pointers);
 	png_destroy_read_struct(&png, &info, NULL);
 	delete[] row_pointers;
 
-	*width = w;
-	*height = h;
+	*size = glm::uvec2(w, h);
 	return true;
 }
 
+//allocate function that stores the image in a std::vector:
+static glm::u8vec4 *allocate_vector(void *data_, glm::uvec2 const &size, size_t *stride) {
+	vector< glm::u8vec4 > &data = *reinterpret_cast< vector< glm::u8vec4 > * >(data_);
+	data.resize(size.x * size.y);
+	*stride = size.x;
+	return data.data();
+}
+
+//allocate function that returns the caller-supplied storage of a PNGDecodeJob:
+static glm::u8vec4 *allocate_job(void *job_, glm::uvec2 const &size, size_t *stride) {
+	PNGDecodeJob const &job = *reinterpret_cast< PNGDecodeJob const * >(job_);
+	if (size != job.size) {
+		LOG_ERROR("  image is " << size.x << "x" << size.y << ", but job expected " << job.size.x << "x" << job.size.y << ".");
+		return nullptr;
+	}
+	*stride = (job.row_stride ? job.row_stride : size.x);
+	return job.pixels;
+}
+
+//read PNG data from memory:
+struct MemoryReader {
+	png_bytep data;
+	size_t size;
+	size_t at;
+};
+
+static void memory_read_data(png_structp png_ptr, png_bytep data, png_size_t length) {
+	MemoryReader *from = reinterpret_cast< MemoryReader * >(png_get_io_ptr(png_ptr));
+	assert(from);
+	if (from->size - from->at < length) {
+		png_error(png_ptr, "Error reading.");
+	}
+	std::memcpy(data, from->data + from->at, length);
+	from->at += length;
+}
+
+bool load_png(std::istream &from, unsigned int *width, unsigned int *height, vector< glm::u8vec4 > *data, OriginLocation origin) {
+	assert(data);
+	uint32_t local_width, local_height;
+	if (width == nullptr) width = &local_width;
+	if (height == nullptr) height = &local_height;
+	*width = *height = 0;
+	data->clear();
+
+	glm::uvec2 size;
+	if (!decode_png(user_read_data, &from, allocate_vector, data, &size, origin)) {
+		data->clear();
+		return false;
+	}
+
+	*width = size.x;
+	*height = size.y;
+	return true;
+}
+
+void load_png(char const *png_data, size_t png_size, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin) {
+	assert(size);
+	assert(data);
+	data->clear();
+	if (png_size < 8 || png_sig_cmp((png_const_bytep)png_data, 0, 8) != 0) {
+		*size = glm::uvec2(0);
+		throw std::runtime_error("Data doesn't start with a PNG header.");
+	}
+	MemoryReader from{ (png_bytep)png_data, png_size, 0 };
+	if (!decode_png(memory_read_data, &from, allocate_vector, data, size, origin)) {
+		data->clear();
+		*size = glm::uvec2(0);
+		throw std::runtime_error("Failed to decode PNG image from memory.");
+	}
+}
+
+glm::uvec2 peek_png_size(char const *png_data, size_t png_size) {
+	//PNG signature, then IHDR chunk: |len (4)|"IHDR"|width (4, big endian)|height (4, big endian)|...
+	if (png_size < 24 || png_sig_cmp((png_const_bytep)png_data, 0, 8) != 0 || std::memcmp(png_data + 12, "IHDR", 4) != 0) {
+		throw std::runtime_error("Data doesn't start with a PNG header.");
+	}
+	png_const_bytep ihdr = (png_const_bytep)png_data + 16;
+	return glm::uvec2(png_get_uint_32(ihdr), png_get_uint_32(ihdr + 4));
+}
+
+void decode_png(PNGDecodeJob const &job, OriginLocation origin) {
+	assert(job.pixels);
+	assert(job.row_stride == 0 || job.row_stride >= job.size.x);
+	MemoryReader from{ (png_bytep)job.png_data, job.png_size, 0 };
+	glm::uvec2 size;
+	if (!decode_png(memory_read_data, &from, allocate_job, const_cast< PNGDecodeJob * >(&job), &size, origin)) {
+		throw std::runtime_error("Failed to decode PNG image from memory.");
+	}
+}
+
+void decode_pngs(std::vector< PNGDecodeJob > const &jobs, OriginLocation origin) {
+	//(each libpng read struct is independent, so decodes can run at the same time)
+	WorkerPool::shared().run(uint32_t(jobs.size()), [&](uint32_t i){
+		decode_png(jobs[i], origin);
+	});
+}
+
 
 void save_png(std::ostream &to, unsigned int width, unsigned int height, glm::u8vec4 const *data, OriginLocation origin) {
 //After the libpng example.c
@@ -173,3 +287,251 @@ void save_png(std::ostream &to, unsigned int width, unsigned int height, glm::u8
 
 	return;
 }
+
+
+//------------------------------------------
+//Parallel encoder:
+// The image is cut into strips of rows. Each strip is filtered and deflated independently
+// (ending on a byte boundary with Z_SYNC_FLUSH, except the last, which finishes the stream),
+// so the compressed strips can simply be concatenated into one zlib stream.
+// Each strip is written as its own IDAT chunk.
+
+//rows per strip; fixed (rather than based on thread count) so output doesn't depend on the machine:
+constexpr uint32_t EncodeStripRows = 64;
+
+static uint8_t paeth_predictor(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = std::abs(p - a);
+	int pb = std::abs(p - b);
+	int pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) return uint8_t(a);
+	if (pb <= pc) return uint8_t(b);
+	return uint8_t(c);
+}
+
+//filter one row ('prev' is nullptr for the first row of the image); writes filter byte + filtered row to 'out':
+// ('scratch' is another row_bytes + 1 bytes, only used by PNGFilterAdaptive to try filters)
+static void filter_row(uint8_t const *row, uint8_t const *prev, size_t row_bytes, PNGFilter filter, uint8_t *out, uint8_t *scratch) {
+	constexpr size_t bpp = 4; //RGBA8
+
+	auto apply = [&](PNGFilter f, uint8_t *to) {
+		to[0] = uint8_t(f == PNGFilterNone ? 0 : f == PNGFilterSub ? 1 : f == PNGFilterUp ? 2 : f == PNGFilterAverage ? 3 : 4);
+		uint8_t *o = to + 1;
+		if (f == PNGFilterNone) {
+			std::memcpy(o, row, row_bytes);
+		} else if (f == PNGFilterSub) {
+			for (size_t i = 0; i < bpp; ++i) o[i] = row[i];
+			for (size_t i = bpp; i < row_bytes; ++i) o[i] = uint8_t(row[i] - row[i - bpp]);
+		} else if (f == PNGFilterUp) {
+			if (prev) for (size_t i = 0; i < row_bytes; ++i) o[i] = uint8_t(row[i] - prev[i]);
+			else std::memcpy(o, row, row_bytes);
+		} else if (f == PNGFilterAverage) {
+			for (size_t i = 0; i < row_bytes; ++i) {
+				int left = (i >= bpp ? row[i - bpp] : 0);
+				int up = (prev ? prev[i] : 0);
+				o[i] = uint8_t(row[i] - ((left + up) >> 1));
+			}
+		} else {
+			for (size_t i = 0; i < row_bytes; ++i) {
+				int left = (i >= bpp ? row[i - bpp] : 0);
+				int up = (prev ? prev[i] : 0);
+				int up_left = (prev && i >= bpp ? prev[i - bpp] : 0);
+				o[i] = uint8_t(row[i] - paeth_predictor(left, up, up_left));
+			}
+		}
+	};
+
+	if (filter != PNGFilterAdaptive) {
+		apply(filter, out);
+		return;
+	}
+
+	//adaptive: keep the filter with the smallest sum of (signed) magnitudes, as suggested by the PNG spec:
+	// (each filter is tried in whichever buffer isn't holding the best so far)
+	uint8_t *best_row = nullptr;
+	uint64_t best = -1ULL;
+	for (PNGFilter f : { PNGFilterNone, PNGFilterSub, PNGFilterUp, PNGFilterAverage, PNGFilterPaeth }) {
+		uint8_t *trial = (best_row == out ? scratch : out);
+		apply(f, trial);
+		uint64_t sum = 0;
+		for (size_t i = 1; i <= row_bytes; ++i) {
+			sum += uint64_t(std::abs(int(int8_t(trial[i]))));
+		}
+		if (sum < best) {
+			best = sum;
+			best_row = trial;
+		}
+	}
+	if (best_row != out) std::memcpy(out, best_row, row_bytes + 1);
+}
+
+static void write_u32_be(uint32_t value, char *to) {
+	to[0] = char((value >> 24) & 0xff);
+	to[1] = char((value >> 16) & 0xff);
+	to[2] = char((value >> 8) & 0xff);
+	to[3] = char(value & 0xff);
+}
+
+//encode to a sequence of calls to 'write' (so save_png can write strips to the file without gathering them first):
+static void encode_png(glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options, std::function< void(char const *, size_t) > const &write) {
+	assert(size.x > 0 && size.y > 0);
+	assert(data);
+	int level = std::max(0, std::min(9, options.compression_level));
+
+	size_t const row_bytes = size_t(size.x) * sizeof(glm::u8vec4);
+	//rows in file (top-to-bottom) order:
+	auto get_row = [&](uint32_t r) -> uint8_t const * {
+		uint32_t y = (origin == UpperLeftOrigin ? r : size.y - 1 - r);
+		return reinterpret_cast< uint8_t const * >(data + size_t(y) * size.x);
+	};
+
+	struct Strip {
+		std::unique_ptr< char[] > deflated; //(not a std::vector, to skip zero-filling)
+		size_t deflated_size = 0;
+		uLong adler = 1; //adler32 of the filtered (uncompressed) bytes
+		size_t filtered_size = 0;
+		uLong crc = 0; //crc32 of deflated bytes
+		bool ok = false;
+	};
+	uint32_t strip_count = (size.y + EncodeStripRows - 1) / EncodeStripRows;
+	std::vector< Strip > strips(strip_count);
+
+	auto encode_strip = [&](uint32_t s) {
+		Strip &strip = strips[s];
+		uint32_t begin = s * EncodeStripRows;
+		uint32_t end = std::min(size.y, begin + EncodeStripRows);
+
+		//deflate as a raw stream:
+		z_stream z;
+		std::memset(&z, 0, sizeof(z));
+		if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return;
+		strip.filtered_size = (end - begin) * (row_bytes + 1);
+		size_t capacity = deflateBound(&z, uLong(strip.filtered_size)) + 16;
+		strip.deflated.reset(new char[capacity]);
+		z.next_out = reinterpret_cast< Bytef * >(strip.deflated.get());
+		z.avail_out = uInt(capacity);
+
+		bool last = (s + 1 == strip_count);
+		int ret = Z_OK;
+		auto feed = [&](uint8_t const *bytes, size_t count, int flush) {
+			strip.adler = adler32(strip.adler, bytes, uInt(count));
+			z.next_in = const_cast< Bytef * >(bytes);
+			z.avail_in = uInt(count);
+			ret = deflate(&z, flush);
+		};
+
+		//filter rows:
+		std::vector< uint8_t > filtered(row_bytes + 1);
+		std::vector< uint8_t > filter_scratch(options.filter == PNGFilterAdaptive ? row_bytes + 1 : 0); //(for trying filters)
+		std::vector< uint8_t > opaque_rows;
+		if (options.opaque) opaque_rows.resize(2 * row_bytes);
+		for (uint32_t r = begin; r < end; ++r) {
+			uint8_t const *row = get_row(r);
+			uint8_t const *prev = (r > 0 ? get_row(r - 1) : nullptr);
+			if (options.opaque) {
+				//force alpha to 0xff in copies of the rows:
+				uint8_t *row_copy = opaque_rows.data();
+				uint8_t *prev_copy = opaque_rows.data() + row_bytes;
+				std::memcpy(row_copy, row, row_bytes);
+				for (size_t i = 3; i < row_bytes; i += 4) row_copy[i] = 0xff;
+				if (prev) {
+					std::memcpy(prev_copy, prev, row_bytes);
+					for (size_t i = 3; i < row_bytes; i += 4) prev_copy[i] = 0xff;
+					prev = prev_copy;
+				}
+				row = row_copy;
+			}
+			int flush = (r + 1 < end ? Z_NO_FLUSH : last ? Z_FINISH : Z_SYNC_FLUSH);
+			if (options.filter == PNGFilterNone) {
+				//no need to copy unfiltered rows:
+				static uint8_t const none = 0;
+				feed(&none, 1, Z_NO_FLUSH);
+				feed(row, row_bytes, flush);
+			} else {
+				filter_row(row, prev, row_bytes, options.filter, filtered.data(), filter_scratch.data());
+				feed(filtered.data(), filtered.size(), flush);
+			}
+			if (ret != Z_OK && ret != Z_STREAM_END) break;
+		}
+		strip.deflated_size = capacity - z.avail_out;
+		deflateEnd(&z);
+		if (last ? (ret != Z_STREAM_END) : (ret != Z_OK || z.avail_in != 0)) return;
+
+		strip.crc = crc32(0L, reinterpret_cast< Bytef const * >(strip.deflated.get()), uInt(strip.deflated_size));
+		strip.ok = true;
+	};
+
+	if (options.parallel) {
+		WorkerPool::shared().run(strip_count, encode_strip);
+	} else {
+		for (uint32_t s = 0; s < strip_count; ++s) {
+			encode_strip(s);
+		}
+	}
+
+	for (auto const &strip : strips) {
+		if (!strip.ok) throw std::runtime_error("Failed to compress PNG data.");
+	}
+
+	//write a chunk whose data is prefix + body + suffix, where crc32(body) is already known:
+	auto write_chunk = [&write](char const *type, std::string const &prefix, char const *body, size_t body_size, uLong body_crc, std::string const &suffix) {
+		char header[8];
+		write_u32_be(uint32_t(prefix.size() + body_size + suffix.size()), header);
+		std::memcpy(header + 4, type, 4);
+		uLong crc = crc32(0L, reinterpret_cast< Bytef const * >(type), 4);
+		if (!prefix.empty()) crc = crc32(crc, reinterpret_cast< Bytef const * >(prefix.data()), uInt(prefix.size()));
+		if (body_size) crc = crc32_combine(crc, body_crc, z_off_t(body_size));
+		if (!suffix.empty()) crc = crc32(crc, reinterpret_cast< Bytef const * >(suffix.data()), uInt(suffix.size()));
+		char footer[4];
+		write_u32_be(uint32_t(crc), footer);
+
+		write(header, 8);
+		if (!prefix.empty()) write(prefix.data(), prefix.size());
+		if (body_size) write(body, body_size);
+		if (!suffix.empty()) write(suffix.data(), suffix.size());
+		write(footer, 4);
+	};
+
+	//signature:
+	static char const signature[8] = { char(0x89), 'P', 'N', 'G', '\r', '\n', char(0x1a), '\n' };
+	write(signature, 8);
+
+	{ //header:
+		std::string ihdr(13, '\0');
+		write_u32_be(size.x, &ihdr[0]);
+		write_u32_be(size.y, &ihdr[4]);
+		ihdr[8] = 8; //bit depth
+		ihdr[9] = 6; //color type: RGBA
+		ihdr[10] = 0; //compression: deflate
+		ihdr[11] = 0; //filter method: adaptive
+		ihdr[12] = 0; //interlace: none
+		write_chunk("IHDR", ihdr, nullptr, 0, 0, "");
+	}
+
+	//zlib stream header (CMF, FLG) with level hint; (CMF*256 + FLG) is a multiple of 31:
+	std::string zlib_header = { char(0x78), char(level <= 1 ? 0x01 : level <= 5 ? 0x5e : level == 6 ? 0x9c : 0xda) };
+
+	uLong adler = 1;
+	for (uint32_t s = 0; s < strip_count; ++s) {
+		Strip const &strip = strips[s];
+		adler = adler32_combine(adler, strip.adler, z_off_t(strip.filtered_size));
+		//first/last IDAT also carry the zlib header/trailer:
+		std::string trailer;
+		if (s + 1 == strip_count) {
+			trailer.resize(4);
+			write_u32_be(uint32_t(adler), &trailer[0]);
+		}
+		write_chunk("IDAT", (s == 0 ? zlib_header : ""), strip.deflated.get(), strip.deflated_size, strip.crc, trailer);
+	}
+
+	write_chunk("IEND", "", nullptr, 0, 0, "");
+}
+
+void encode_png(glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options, std::vector< char > *png_) {
+	assert(png_);
+	auto &png = *png_;
+	png.clear();
+	encode_png(size, data, origin, options, [&png](char const *bytes, size_t count) {
+		png.insert(png.end(), bytes, bytes + count);
+	});
+}
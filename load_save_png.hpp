@@ -4,6 +4,7 @@
 
 #include <string>
 #include <vector>
+#include <istream>
 #include <stdint.h>
 
 /*
@@ -15,6 +16,67 @@ enum OriginLocation {
 	UpperLeftOrigin,
 };
 
+//save_png options (the encoder compresses horizontal strips of the image in parallel):
+enum PNGFilter {
+	PNGFilterNone, //fastest; good with compression level 0
+	PNGFilterSub,
+	PNGFilterUp,
+	PNGFilterAverage,
+	PNGFilterPaeth,
+	PNGFilterAdaptive, //pick a filter per row (like libpng's default); smallest files
+};
+
+struct PNGSaveOptions {
+	int compression_level = 6; //zlib level: 0 == store (no compression), 1 == fastest, 9 == smallest
+	PNGFilter filter = PNGFilterAdaptive;
+	bool parallel = true; //compress strips on WorkerPool::shared()
+	bool opaque = false; //write alpha as 0xff (e.g., for framebuffer captures)
+
+	//preset for screenshots/captures where speed matters more than size:
+	static PNGSaveOptions fast() {
+		PNGSaveOptions options;
+		options.compression_level = 1;
+		options.filter = PNGFilterUp;
+		return options;
+	}
+	//preset that doesn't compress at all:
+	static PNGSaveOptions store() {
+		PNGSaveOptions options;
+		options.compression_level = 0;
+		options.filter = PNGFilterNone;
+		return options;
+	}
+};
+
 //NOTE: load_png will throw on error
 void load_png(std::string filename, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin);
-void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin);
+void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options = PNGSaveOptions());
+
+//encode a PNG into memory:
+void encode_png(glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin, PNGSaveOptions const &options, std::vector< char > *png);
+
+//write a PNG with libpng's default settings, on the calling thread:
+void save_png(std::ostream &to, unsigned int width, unsigned int height, glm::u8vec4 const *data, OriginLocation origin);
+
+//decode PNG data that is already in memory (e.g., a DataBlob from read_data_file); throws on error:
+void load_png(char const *png_data, size_t png_size, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin);
+
+//decode PNG data from a stream, one libpng read callback at a time; returns false on error:
+bool load_png(std::istream &from, unsigned int *width, unsigned int *height, std::vector< glm::u8vec4 > *data, OriginLocation origin);
+
+//read the image size from the header of PNG data in memory; throws on error:
+glm::uvec2 peek_png_size(char const *png_data, size_t png_size);
+
+//decode PNG data in memory into caller-provided (possibly GPU-mapped) pixels:
+// rows are written directly in 'origin' order, 'row_stride' pixels apart.
+struct PNGDecodeJob {
+	char const *png_data = nullptr;
+	size_t png_size = 0;
+	glm::uvec2 size = glm::uvec2(0); //must match the image (see peek_png_size)
+	glm::u8vec4 *pixels = nullptr;
+	size_t row_stride = 0; //0 means size.x
+};
+void decode_png(PNGDecodeJob const &job, OriginLocation origin); //throws on error
+
+//decode several PNGs concurrently on WorkerPool::shared(); throws (once all jobs are done) if any failed:
+void decode_pngs(std::vector< PNGDecodeJob > const &jobs, OriginLocation origin);
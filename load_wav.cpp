@@ -1,4 +1,6 @@
 #include "load_wav.hpp"
+#include "data_files.hpp"
+#include "mix_kernels.hpp"
 
 #include <SDL.h>
 
@@ -16,16 +18,22 @@ void load_wav(std::string const &filename, std::vector< float > *data_) {
 	Uint8 *audio_buf = nullptr;
 	Uint32 audio_len = 0;
 
-	SDL_AudioSpec *have = SDL_LoadWAV(filename.c_str(), &audio_spec, &audio_buf, &audio_len);
+	//file contents (possibly served directly from the asset pack):
+	DataBlob blob = read_data_file(filename);
+
+	SDL_AudioSpec *have = SDL_LoadWAV_RW(SDL_RWFromConstMem(blob.data, int(blob.size)), 1, &audio_spec, &audio_buf, &audio_len);
 	if (!have) {
 		throw std::runtime_error("Failed to load WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
 	}
 
 	//based on the SDL_AudioCVT example in the docs: https://wiki.libsdl.org/SDL_AudioCVT
+	// (SDL converts the format and channels; the rate is converted below, with the mixer's resampler)
 	SDL_AudioCVT cvt;
-	SDL_BuildAudioCVT(&cvt, have->format, have->channels, have->freq, AUDIO_F32SYS, 1, AUDIO_RATE);
-	if (cvt.needed) {
+	SDL_BuildAudioCVT(&cvt, have->format, have->channels, have->freq, AUDIO_F32SYS, 1, have->freq);
+	if (cvt.needed || have->freq != int(AUDIO_RATE)) {
 		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AUDIO_RATE) + " Hz, float32, mono; converting." << std::endl;
+	}
+	if (cvt.needed) {
 		cvt.len = audio_len;
 		cvt.buf = (Uint8 *)SDL_malloc(cvt.len * cvt.len_mult);
 		SDL_memcpy(cvt.buf, audio_buf, audio_len);
@@ -40,6 +48,12 @@ void load_wav(std::string const &filename, std::vector< float > *data_) {
 	}
 	SDL_FreeWAV(audio_buf);
 
+	if (have->freq != int(AUDIO_RATE)) {
+		std::vector< float > converted;
+		resample_buffer(data.data(), uint32_t(data.size()), double(have->freq) / double(AUDIO_RATE), &converted);
+		data = std::move(converted);
+	}
+
 	float min = 0.0f;
 	float max = 0.0f;
 	for (auto d : data) {
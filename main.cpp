@@ -14,7 +14,7 @@
 #include "GL.hpp"
 
 //for screenshots:
-#include "load_save_png.hpp"
+#include "Capture.hpp"
 
 //Includes for libSDL:
 #include <SDL.h>
@@ -131,6 +131,9 @@ int main(int argc, char **argv) {
 	};
 	on_resize();
 
+	//screenshots and frame sequences:
+	Capture capture;
+
 	//This will loop until the current mode is set to null:
 	while (Mode::current) {
 		//every pass through the game loop creates one frame of output
@@ -150,19 +153,14 @@ int main(int argc, char **argv) {
 					Mode::set_current(nullptr);
 					break;
 				} else if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_PRINTSCREEN) {
-					// --- screenshot key ---
-					std::string filename = "screenshot.png";
-					std::cout << "Saving screenshot to '" << filename << "'." << std::endl;
-					glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-					glReadBuffer(GL_FRONT);
-					int w,h;
-					SDL_GL_GetDrawableSize(window, &w, &h);
-					std::vector< glm::u8vec4 > data(w*h);
-					glReadPixels(0,0,w,h, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
-					for (auto &px : data) {
-						px.a = 0xff;
+					// --- screenshot key (saved after the next frame is drawn) ---
+					if (evt.key.keysym.mod & KMOD_SHIFT) {
+						//SHIFT: start/stop saving a sequence of frames:
+						if (capture.sequence_running()) capture.stop_sequence();
+						else capture.start_sequence("capture-", 30.0f);
+					} else {
+						capture.screenshot("screenshot.png");
 					}
-					save_png(filename, glm::uvec2(w,h), data.data(), LowerLeftOrigin);
 				}
 			}
 			if (!Mode::current) break;
@@ -187,6 +185,9 @@ int main(int argc, char **argv) {
 			Mode::current->draw(drawable_size);
 		}
 
+		//read back the frame if a screenshot or sequence frame is due (doesn't wait for the GPU):
+		capture.frame(drawable_size);
+
 		//Wait until the recently-drawn frame is shown before doing it all again:
 		SDL_GL_SwapWindow(window);
 	}
@@ -195,6 +196,9 @@ int main(int argc, char **argv) {
 	//------------  teardown ------------
 	Sound::shutdown();
 
+	//save any frames still in flight (needs the GL context):
+	capture.finish();
+
 	SDL_GL_DeleteContext(context);
 	context = 0;
 
@@ -0,0 +1,311 @@
+#include "Sound.hpp"
+
+#include <glm/gtc/constants.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <cmath>
+
+//mix-bench runs the audio mixer offline on a scripted scene and reports the mixing cost:
+// usage: mix-bench [voices] [seconds] [output.wav]
+// (defaults to 256 voices for 10 seconds; the mix is written to 'output.wav' if given)
+//The scene is mixed with the default block size, with the samples stored in compact formats,
+// with every voice at a different playback rate (so resampled), on all hardware threads, and then with
+// smaller (lower-latency) blocks. Voices are spread over the effects, ambience, and music buses.
+//The script is the same every run, so the output (and its checksum) should be too.
+//Finally, it seeks a playing Stream and reports how long until audio from the new position arrives.
+
+//small deterministic random number generator (so the script doesn't depend on the standard library's):
+struct LCG {
+	uint32_t state;
+	explicit LCG(uint32_t seed) : state(seed) { }
+	float next() { //in [0,1)
+		state = state * 1664525U + 1013904223U;
+		return float(state >> 8) / float(1U << 24);
+	}
+};
+
+//write interleaved stereo float samples as a 32-bit float '.wav' file:
+static void write_wav(std::string const &filename, std::vector< float > const &samples, uint32_t rate) {
+	std::ofstream out(filename, std::ios::binary);
+	auto u32 = [&](uint32_t v) { out.write(reinterpret_cast< char const * >(&v), 4); };
+	auto u16 = [&](uint16_t v) { out.write(reinterpret_cast< char const * >(&v), 2); };
+	uint32_t data_bytes = uint32_t(samples.size() * sizeof(float));
+	out.write("RIFF", 4); u32(36 + data_bytes); out.write("WAVE", 4);
+	out.write("fmt ", 4); u32(16);
+	u16(3); //WAVE_FORMAT_IEEE_FLOAT
+	u16(2); //channels
+	u32(rate); u32(rate * 2 * sizeof(float));
+	u16(2 * sizeof(float)); u16(32);
+	out.write("data", 4); u32(data_bytes);
+	out.write(reinterpret_cast< char const * >(samples.data()), data_bytes);
+	if (!out) throw std::runtime_error("Failed to write '" + filename + "'.");
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	try {
+#endif
+	uint32_t voices = (argc > 1 ? uint32_t(std::stoul(argv[1])) : 256);
+	float seconds = (argc > 2 ? std::stof(argv[2]) : 10.0f);
+	std::string wav_filename = (argc > 3 ? argv[3] : "");
+	if (argc > 4 || voices == 0 || voices > Sound::MaxVoices) {
+		std::cerr << "Usage:\n\t" << argv[0] << " [voices (1-" << Sound::MaxVoices << ")] [seconds] [output.wav]" << std::endl;
+		return 1;
+	}
+
+	Sound::init_offline();
+	uint32_t const rate = 48000;
+	uint32_t block = Sound::block_size();
+	uint32_t blocks = std::max(1U, uint32_t(seconds * rate) / block);
+
+	//a handful of synthetic samples (tones and filtered noise) of different lengths, in each storage format:
+	std::vector< Sound::Sample > samples, samples_int16, samples_adpcm;
+	{
+		LCG rng(1);
+		for (uint32_t s = 0; s < 8; ++s) {
+			std::vector< float > data(uint32_t(rate * (0.25f + 0.25f * s)));
+			float freq = 110.0f * float(s + 1);
+			float noise = 0.0f;
+			for (uint32_t i = 0; i < data.size(); ++i) {
+				noise = 0.9f * noise + 0.1f * (2.0f * rng.next() - 1.0f);
+				data[i] = 0.5f * (std::sin(2.0f * glm::pi< float >() * freq * float(i) / float(rate)) + noise); //(within [-1,1], so int16 doesn't clip)
+			}
+			samples.emplace_back(data);
+			samples_int16.emplace_back(data, Sound::Sample::Format::Int16);
+			samples_adpcm.emplace_back(data, Sound::Sample::Format::ADPCM);
+		}
+	}
+	auto library_bytes = [](std::vector< Sound::Sample > const &library) {
+		size_t bytes = 0;
+		for (auto const &sample : library) bytes += sample.bytes();
+		return bytes;
+	};
+	//worst-case difference from the float samples:
+	auto library_error = [&](std::vector< Sound::Sample > const &library) {
+		float error = 0.0f;
+		for (uint32_t s = 0; s < samples.size(); ++s) {
+			std::vector< float > const &data = samples[s].data;
+			std::vector< float > out;
+			Sound::init_offline(); //(render the sample by itself at full volume and center pan, on a fresh mixer)
+			Sound::play(library[s], 1.0f, 0.0f);
+			out.resize((data.size() / Sound::block_size() + 1) * Sound::block_size() * 2);
+			Sound::render(out.data(), uint32_t(out.size() / 2));
+			for (uint32_t i = 0; i < data.size(); ++i) {
+				error = std::max(error, std::abs(out[2 * i] / std::cos(0.25f * glm::pi< float >()) - data[i]));
+			}
+			Sound::shutdown();
+		}
+		return error;
+	};
+
+	//playback rates are spread over [1 - pitch_spread, 1 + pitch_spread]:
+	float pitch_spread = 0.0f;
+
+	//the script: 'voices' looping sounds circling the listener; every few blocks one stops and a one-shot starts:
+	auto run = [&](std::vector< Sound::Sample > const &samples, uint32_t max_real, std::vector< float > *out) -> double {
+		Sound::set_max_real_voices(max_real);
+		out->assign(size_t(blocks) * block * 2, 0.0f);
+		LCG rng(2);
+		Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), 0.0f);
+
+		std::vector< Sound::PlayingSample > playing;
+		std::vector< float > radius, speed, phase;
+		for (uint32_t v = 0; v < voices; ++v) {
+			radius.emplace_back(1.0f + 20.0f * rng.next());
+			speed.emplace_back(0.5f * (rng.next() - 0.5f));
+			phase.emplace_back(2.0f * glm::pi< float >() * rng.next());
+			playing.emplace_back(Sound::loop_3D(samples[v % samples.size()], 0.5f / std::sqrt(float(voices)), glm::vec3(radius[v] * std::cos(phase[v]), radius[v] * std::sin(phase[v]), 0.0f), 4.0f));
+			if (pitch_spread != 0.0f) playing.back().set_rate(1.0f + pitch_spread * (2.0f * rng.next() - 1.0f), 0.0f);
+			playing.back().set_bus(Sound::Bus(v % Sound::BusCount));
+		}
+
+		double mix_seconds = 0.0;
+		for (uint32_t b = 0; b < blocks; ++b) {
+			float t = float(b) * float(block) / float(rate);
+			//(no ramp at the start, so each run starts from the same listener state)
+			Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(std::cos(0.1f * t), std::sin(0.1f * t), 0.0f), (b == 0 ? 0.0f : float(block) / float(rate)));
+			//(voices start where they are at t = 0, which keeps the first block's commands within the queue even at MaxVoices)
+			for (uint32_t v = 0; b != 0 && v < voices; ++v) {
+				float ang = phase[v] + speed[v] * t;
+				playing[v].set_position(glm::vec3(radius[v] * std::cos(ang), radius[v] * std::sin(ang), 0.0f), float(block) / float(rate));
+			}
+			if (b % 8 == 7) {
+				uint32_t v = (b / 8) % voices;
+				playing[v].stop(0.05f);
+				Sound::play_3D(samples[(b / 8) % samples.size()], 0.5f, glm::vec3(radius[v], 0.0f, 0.0f), 4.0f);
+				playing[v] = Sound::loop_3D(samples[(v + b) % samples.size()], 0.5f / std::sqrt(float(voices)), glm::vec3(radius[v], 0.0f, 0.0f), 4.0f);
+				if (pitch_spread != 0.0f) playing[v].set_rate(1.0f + pitch_spread * (2.0f * rng.next() - 1.0f), 0.0f);
+				playing[v].set_bus(Sound::Bus(v % Sound::BusCount));
+			}
+
+			auto before = std::chrono::high_resolution_clock::now();
+			Sound::render(out->data() + size_t(b) * block * 2, block);
+			auto after = std::chrono::high_resolution_clock::now();
+			mix_seconds += std::chrono::duration< double >(after - before).count();
+		}
+
+		//let everything finish so the next run starts from silence:
+		Sound::stop_all_samples();
+		std::vector< float > drain(block * 2);
+		for (uint32_t b = 0; b * block < rate / 10; ++b) { //(a tenth of a second, longer than any stop ramp)
+			Sound::render(drain.data(), block);
+		}
+		return mix_seconds;
+	};
+
+	//FNV-1a over the output's bits:
+	auto checksum = [](std::vector< float > const &data) {
+		uint64_t hash = 14695981039346656037ULL;
+		for (float f : data) {
+			uint32_t bits;
+			std::memcpy(&bits, &f, 4);
+			for (uint32_t i = 0; i < 4; ++i) {
+				hash = (hash ^ ((bits >> (8 * i)) & 0xff)) * 1099511628211ULL;
+			}
+		}
+		return hash;
+	};
+
+	std::cout << "Mixing " << voices << " voices for " << blocks << " blocks of " << block << " samples (" << (float(blocks) * float(block) / float(rate)) << "s):" << std::endl;
+
+	auto report = [&](std::string const &name, uint32_t max_real, std::vector< Sound::Sample > const &library) {
+		double budget = double(block) / double(rate);
+		std::vector< float > out;
+		run(library, max_real, &out); //warm up (and reference output)
+		uint64_t first = checksum(out);
+		double mix_seconds = run(library, max_real, &out);
+		uint64_t second = checksum(out);
+		double per_block = mix_seconds / blocks;
+		std::cout << "  " << std::setw(30) << std::left << name
+		          << std::setw(9) << std::right << std::fixed << std::setprecision(1) << (per_block * 1e9 / double(voices)) << " ns/voice/block"
+		          << std::setw(9) << std::fixed << std::setprecision(3) << (per_block * 1e3) << " ms/block"
+		          << std::setw(7) << std::fixed << std::setprecision(1) << (100.0 * per_block / budget) << "% of budget"
+		          << "  checksum " << std::hex << second << std::dec << (first == second ? "" : " (NOT DETERMINISTIC)")
+		          << std::endl;
+		return out;
+	};
+
+	std::vector< float > out = report("all voices real", voices, samples);
+	Sound::stats(); //(reset)
+	report("64 real", 64, samples);
+	std::cout << "  " << Sound::stats() << std::endl; //(both runs, and the drains)
+
+	//compact sample formats (decoded while mixing):
+	report("all voices real, int16", voices, samples_int16);
+	report("all voices real, ADPCM", voices, samples_adpcm);
+	std::cout << "  sample memory: " << library_bytes(samples) << " bytes float32, "
+	          << library_bytes(samples_int16) << " int16, " << library_bytes(samples_adpcm) << " ADPCM" << std::endl;
+	Sound::shutdown();
+	std::cout << "  max error: " << std::scientific << std::setprecision(2) << library_error(samples_int16) << " int16, " << library_error(samples_adpcm) << " ADPCM" << std::defaultfloat << std::endl;
+	Sound::init_offline();
+
+	//resampling every voice:
+	pitch_spread = 0.2f;
+	report("all voices real, cubic", voices, samples);
+	Sound::shutdown();
+	{
+		Sound::Settings settings;
+		settings.cubic = false;
+		Sound::init_offline(settings);
+	}
+	report("all voices real, linear", voices, samples);
+	pitch_spread = 0.0f;
+
+	//multi-threaded mixing (output should match the single-threaded checksum):
+	Sound::shutdown();
+	{
+		Sound::Settings settings;
+		settings.mix_threads = 0;
+		Sound::init_offline(settings);
+	}
+	report("all voices real, " + std::to_string(std::max(1U, std::thread::hardware_concurrency())) + " threads", voices, samples);
+	{
+		Sound::MixCost cost = Sound::mix_cost(); //(includes the warm-up run)
+		std::cout << "  per bus (summed over threads): " << std::fixed << std::setprecision(3)
+		          << (1e3f * cost.bus[0]) << " ms effects, " << (1e3f * cost.bus[1]) << " ms ambience, " << (1e3f * cost.bus[2]) << " ms music"
+		          << "; slowest block " << (1e3f * cost.peak) << " ms" << std::defaultfloat << std::endl;
+	}
+
+	//same scene with smaller blocks (same length of audio; output differs slightly since ramps are per-block):
+	for (uint32_t small : {256U, 128U}) {
+		Sound::shutdown();
+		Sound::Settings settings;
+		settings.block_size = small;
+		Sound::init_offline(settings);
+		uint32_t length = blocks * block;
+		block = Sound::block_size();
+		blocks = length / block;
+		report("64 real, " + std::to_string(block) + "-sample blocks", 64, samples);
+	}
+
+	//streams: after a seek, audio from the new position should follow within a block or so:
+	Sound::shutdown();
+	Sound::init_offline();
+	block = Sound::block_size();
+	try {
+		Sound::Stream stream("dist/dusty-floor.opus");
+		auto device_wait = [&]() { //(pace blocks like a device would, so the streaming thread gets to run)
+			std::this_thread::sleep_for(std::chrono::duration< double >(double(block) / double(rate)));
+		};
+		std::vector< float > start(block * 2), played(block * 2);
+		Sound::PlayingSample playing = Sound::play(stream, 1.0f, 0.0f);
+		Sound::render(start.data(), block); //(reference: the first block of the stream)
+		for (uint32_t b = 0; b < 16; ++b) {
+			device_wait();
+			Sound::render(played.data(), block);
+		}
+		playing.seek(0.0);
+		uint32_t silent = 0;
+		bool arrived = false;
+		float difference = 0.0f;
+		while (!arrived && silent < 8) {
+			Sound::render(played.data(), block);
+			float peak = 0.0f;
+			for (uint32_t i = 0; i < played.size(); ++i) {
+				peak = std::max(peak, std::abs(played[i]));
+				difference = std::max(difference, std::abs(played[i] - start[i]));
+			}
+			if (peak == 0.0f) {
+				++silent;
+				difference = 0.0f;
+				device_wait();
+			} else {
+				arrived = true;
+			}
+		}
+		std::cout << "  stream seek: ";
+		if (arrived) {
+			std::cout << "audio after " << silent << " silent block(s), max difference from a fresh start " << std::scientific << std::setprecision(2) << difference << std::defaultfloat;
+		} else {
+			std::cout << "NO AUDIO after " << silent << " blocks";
+		}
+		std::cout << std::endl;
+		playing.stop();
+	} catch (std::exception const &e) {
+		std::cout << "  stream seek: skipped (" << e.what() << ")" << std::endl;
+	}
+
+	if (!wav_filename.empty()) {
+		write_wav(wav_filename, out, rate);
+		std::cout << "Wrote '" << wav_filename << "'." << std::endl;
+	}
+
+	Sound::shutdown();
+	return 0;
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
@@ -0,0 +1,182 @@
+#include "mix_kernels.hpp"
+
+#include <cassert>
+#include <cmath>
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define MIX_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define MIX_SSE
+#endif
+
+char const *mix_kernel_name() {
+#if defined(MIX_AVX)
+	return "AVX";
+#elif defined(MIX_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+template< bool Ramp >
+void mix_mono_to_stereo(float const *src, uint32_t count, float *dst,
+	float gain_l, float gain_r, float step_l, float step_r) {
+
+	uint32_t i = 0;
+
+#if defined(MIX_AVX)
+	//eight samples per iteration:
+	{
+		//gains for samples [0..3] and [4..7], as l,r pairs:
+		__m256 g0 = _mm256_setr_ps(
+			gain_l, gain_r,
+			gain_l + step_l, gain_r + step_r,
+			gain_l + 2.0f * step_l, gain_r + 2.0f * step_r,
+			gain_l + 3.0f * step_l, gain_r + 3.0f * step_r);
+		__m256 g1 = _mm256_add_ps(g0, _mm256_setr_ps(
+			4.0f * step_l, 4.0f * step_r, 4.0f * step_l, 4.0f * step_r,
+			4.0f * step_l, 4.0f * step_r, 4.0f * step_l, 4.0f * step_r));
+		__m256 step8 = _mm256_setr_ps(
+			8.0f * step_l, 8.0f * step_r, 8.0f * step_l, 8.0f * step_r,
+			8.0f * step_l, 8.0f * step_r, 8.0f * step_l, 8.0f * step_r);
+		for (; i + 8 <= count; i += 8) {
+			__m256 s = _mm256_loadu_ps(src + i);
+			//duplicate each sample into l,r slots (unpack works within 128-bit lanes, so fix up the order):
+			__m256 lo = _mm256_unpacklo_ps(s, s); //s0 s0 s1 s1 | s4 s4 s5 s5
+			__m256 hi = _mm256_unpackhi_ps(s, s); //s2 s2 s3 s3 | s6 s6 s7 s7
+			__m256 s03 = _mm256_permute2f128_ps(lo, hi, 0x20);
+			__m256 s47 = _mm256_permute2f128_ps(lo, hi, 0x31);
+			float *d = dst + 2 * i;
+			_mm256_storeu_ps(d, _mm256_add_ps(_mm256_loadu_ps(d), _mm256_mul_ps(s03, g0)));
+			_mm256_storeu_ps(d + 8, _mm256_add_ps(_mm256_loadu_ps(d + 8), _mm256_mul_ps(s47, g1)));
+			if (Ramp) {
+				g0 = _mm256_add_ps(g0, step8);
+				g1 = _mm256_add_ps(g1, step8);
+			}
+		}
+	}
+#elif defined(MIX_SSE)
+	//four samples per iteration:
+	{
+		//gains for samples [0,1] and [2,3], as l,r pairs:
+		__m128 g0 = _mm_setr_ps(gain_l, gain_r, gain_l + step_l, gain_r + step_r);
+		__m128 g1 = _mm_add_ps(g0, _mm_setr_ps(2.0f * step_l, 2.0f * step_r, 2.0f * step_l, 2.0f * step_r));
+		__m128 step4 = _mm_setr_ps(4.0f * step_l, 4.0f * step_r, 4.0f * step_l, 4.0f * step_r);
+		for (; i + 4 <= count; i += 4) {
+			__m128 s = _mm_loadu_ps(src + i);
+			__m128 s01 = _mm_unpacklo_ps(s, s); //s0 s0 s1 s1
+			__m128 s23 = _mm_unpackhi_ps(s, s); //s2 s2 s3 s3
+			float *d = dst + 2 * i;
+			_mm_storeu_ps(d, _mm_add_ps(_mm_loadu_ps(d), _mm_mul_ps(s01, g0)));
+			_mm_storeu_ps(d + 4, _mm_add_ps(_mm_loadu_ps(d + 4), _mm_mul_ps(s23, g1)));
+			if (Ramp) {
+				g0 = _mm_add_ps(g0, step4);
+				g1 = _mm_add_ps(g1, step4);
+			}
+		}
+	}
+#endif
+
+	//remaining samples (or all of them, for the scalar version):
+	for (; i < count; ++i) {
+		float l = (Ramp ? gain_l + float(i) * step_l : gain_l);
+		float r = (Ramp ? gain_r + float(i) * step_r : gain_r);
+		dst[2 * i + 0] += src[i] * l;
+		dst[2 * i + 1] += src[i] * r;
+	}
+}
+
+template void mix_mono_to_stereo< false >(float const *, uint32_t, float *, float, float, float, float);
+template void mix_mono_to_stereo< true >(float const *, uint32_t, float *, float, float, float, float);
+
+template< bool Ramp >
+void mix_stereo(float const *src, uint32_t count, float *dst, float gain, float step) {
+	//(simple enough that the compiler vectorizes it)
+	for (uint32_t i = 0; i < count; ++i) {
+		float g = (Ramp ? gain + float(i) * step : gain);
+		dst[2 * i + 0] += src[2 * i + 0] * g;
+		dst[2 * i + 1] += src[2 * i + 1] * g;
+	}
+}
+
+template void mix_stereo< false >(float const *, uint32_t, float *, float, float);
+template void mix_stereo< true >(float const *, uint32_t, float *, float, float);
+
+//one output sample from the four window values around a position ('t' is the fractional part):
+static inline float interpolate_linear(float const *p, float t) {
+	return p[1] + t * (p[2] - p[1]);
+}
+static inline float interpolate_cubic(float const *p, float t) {
+	float c1 = 0.5f * (p[2] - p[0]);
+	float c2 = p[0] - 2.5f * p[1] + 2.0f * p[2] - 0.5f * p[3];
+	float c3 = 0.5f * (p[3] - p[0]) + 1.5f * (p[1] - p[2]);
+	return ((c3 * t + c2) * t + c1) * t + p[1];
+}
+
+template< Interpolation Mode >
+void resample(float const *window, float frac, float step, uint32_t count, float *dst) {
+	uint32_t j = 0;
+
+#if defined(MIX_AVX) || defined(MIX_SSE)
+	//four outputs per iteration (positions are computed as frac + j * step, just like the scalar tail, so results match):
+	{
+		__m128 vfrac = _mm_set1_ps(frac);
+		__m128 vstep = _mm_set1_ps(step);
+		__m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		for (; j + 4 <= count; j += 4) {
+			__m128 x = _mm_add_ps(vfrac, _mm_mul_ps(_mm_add_ps(_mm_set1_ps(float(j)), lanes), vstep));
+			__m128i k = _mm_cvttps_epi32(x); //(x >= 0, so truncation is floor)
+			__m128 t = _mm_sub_ps(x, _mm_cvtepi32_ps(k));
+			alignas(16) int32_t at[4];
+			_mm_store_si128(reinterpret_cast< __m128i * >(at), k);
+			//gather the neighbours (no gather instruction in SSE/AVX, so these are plain loads):
+			float const *w0 = window + at[0], *w1 = window + at[1], *w2 = window + at[2], *w3 = window + at[3];
+			__m128 p1 = _mm_setr_ps(w0[1], w1[1], w2[1], w3[1]);
+			__m128 p2 = _mm_setr_ps(w0[2], w1[2], w2[2], w3[2]);
+			__m128 out;
+			if (Mode == Interpolation::Linear) {
+				out = _mm_add_ps(p1, _mm_mul_ps(t, _mm_sub_ps(p2, p1)));
+			} else {
+				__m128 p0 = _mm_setr_ps(w0[0], w1[0], w2[0], w3[0]);
+				__m128 p3 = _mm_setr_ps(w0[3], w1[3], w2[3], w3[3]);
+				__m128 half = _mm_set1_ps(0.5f);
+				__m128 c1 = _mm_mul_ps(half, _mm_sub_ps(p2, p0));
+				__m128 c2 = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(p0, _mm_mul_ps(_mm_set1_ps(2.5f), p1)), _mm_mul_ps(_mm_set1_ps(2.0f), p2)), _mm_mul_ps(half, p3));
+				__m128 c3 = _mm_add_ps(_mm_mul_ps(half, _mm_sub_ps(p3, p0)), _mm_mul_ps(_mm_set1_ps(1.5f), _mm_sub_ps(p1, p2)));
+				out = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(c3, t), c2), t), c1), t), p1);
+			}
+			_mm_storeu_ps(dst + j, out);
+		}
+	}
+#endif
+
+	//remaining samples (or all of them, for the scalar version):
+	for (; j < count; ++j) {
+		float x = frac + float(j) * step;
+		uint32_t k = uint32_t(x);
+		float t = x - float(k);
+		if (Mode == Interpolation::Linear) dst[j] = interpolate_linear(window + k, t);
+		else dst[j] = interpolate_cubic(window + k, t);
+	}
+}
+
+template void resample< Interpolation::Linear >(float const *, float, float, uint32_t, float *);
+template void resample< Interpolation::Cubic >(float const *, float, float, uint32_t, float *);
+
+void resample_buffer(float const *src, uint32_t count, double step, std::vector< float > *dst_) {
+	assert(dst_);
+	auto &dst = *dst_;
+	assert(step > 0.0);
+	dst.assign(count == 0 ? 0 : size_t(std::ceil(double(count) / step)), 0.0f);
+	//(positions are computed in double so long buffers don't drift; reads past either end are zero)
+	auto at = [&](int64_t i) { return (i < 0 || i >= int64_t(count) ? 0.0f : src[i]); };
+	for (size_t j = 0; j < dst.size(); ++j) {
+		double x = double(j) * step;
+		int64_t k = int64_t(x);
+		float p[4] = { at(k - 1), at(k), at(k + 1), at(k + 2) };
+		dst[j] = interpolate_cubic(p, float(x - double(k)));
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Inner loops of the audio mixer (see mix_block() in Sound.cpp).
+ *
+ * Each kernel adds 'count' mono samples from 'src' into the interleaved stereo
+ *  buffer 'dst' (l,r,l,r,...), scaled by a left/right gain:
+ *
+ *   dst[2*i+0] += src[i] * (gain_l + i * step_l)
+ *   dst[2*i+1] += src[i] * (gain_r + i * step_r)
+ *
+ * The Ramp == false variant ignores 'step' (constant gain).
+ * Uses AVX or SSE when the compiler targets them, otherwise plain scalar code.
+ */
+
+template< bool Ramp >
+void mix_mono_to_stereo(float const *src, uint32_t count, float *dst,
+	float gain_l, float gain_r, float step_l, float step_r);
+
+//add 'count' stereo samples from 'src' to 'dst', scaled by (gain + i * step) (for summing buses):
+template< bool Ramp >
+void mix_stereo(float const *src, uint32_t count, float *dst, float gain, float step);
+
+/*
+ * Resamplers: 'count' output samples at fractional source positions
+ *
+ *   x[j] = frac + j * step    (0 <= frac < 1, step > 0)
+ *
+ * read from 'window', where window[k + 1] is source sample floor(x) == k
+ *  (so window[0] is the sample before the first one, for the cubic's left neighbour).
+ * 'window' must hold at least floor(x[count-1]) + 4 values.
+ */
+enum class Interpolation : uint8_t {
+	Linear, //between the two nearest samples
+	Cubic, //Catmull-Rom spline through the four nearest samples (smoother, slightly more expensive)
+};
+template< Interpolation Mode >
+void resample(float const *window, float frac, float step, uint32_t count, float *dst);
+
+//Resample a whole buffer (used for load-time conversion) by 'step' source samples per output sample:
+// (no low-pass filter, so downsampling by a large factor may alias)
+void resample_buffer(float const *src, uint32_t count, double step, std::vector< float > *dst);
+
+//name of the instruction set the kernels were compiled for ("AVX", "SSE", or "scalar"):
+char const *mix_kernel_name();
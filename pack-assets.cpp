@@ -0,0 +1,76 @@
+#include "AssetPack.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+//pack-assets bundles the game's data files into a single AssetPack:
+// usage: pack-assets [dist-directory] [output.pack]
+// (defaults to 'dist' and 'dist/assets.pack')
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	try {
+#endif
+	if (argc > 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " [dist-directory] [output.pack]" << std::endl;
+		return 1;
+	}
+	std::filesystem::path dir = (argc > 1 ? argv[1] : "dist");
+	std::filesystem::path out = (argc > 2 ? std::filesystem::path(argv[2]) : dir / "assets.pack");
+
+	//file types loaded through data_path():
+	std::vector< std::string > const extensions = {
+		".png", ".pnct", ".scene", ".w", ".opus", ".wav"
+	};
+
+	std::vector< std::filesystem::path > paths;
+	for (auto const &entry : std::filesystem::recursive_directory_iterator(dir)) {
+		if (!entry.is_regular_file()) continue;
+		std::string ext = entry.path().extension().string();
+		if (std::find(extensions.begin(), extensions.end(), ext) == extensions.end()) continue;
+		paths.emplace_back(entry.path());
+	}
+	//sort so that the pack is the same no matter what order the directory is listed in:
+	std::sort(paths.begin(), paths.end());
+
+	std::vector< std::pair< std::string, std::vector< char > > > files;
+	size_t total = 0;
+	for (auto const &path : paths) {
+		//names are relative to the data directory, with '/' separators (as passed to data_path()):
+		std::string name = std::filesystem::relative(path, dir).generic_string();
+
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			std::cerr << "Failed to open '" << path.string() << "'." << std::endl;
+			return 1;
+		}
+		file.seekg(0, std::ios::end);
+		std::vector< char > data(size_t(file.tellg()));
+		file.seekg(0, std::ios::beg);
+		if (!file.read(data.data(), data.size())) {
+			std::cerr << "Failed to read '" << path.string() << "'." << std::endl;
+			return 1;
+		}
+		std::cout << "  " << name << " (" << data.size() << " bytes)" << std::endl;
+		total += data.size();
+		files.emplace_back(name, std::move(data));
+	}
+
+	write_asset_pack(out.string(), files);
+	std::cout << "Wrote " << files.size() << " files (" << total << " bytes) to '" << out.string() << "'." << std::endl;
+
+	return 0;
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
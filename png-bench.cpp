@@ -0,0 +1,158 @@
+#include "load_save_png.hpp"
+#include "data_files.hpp"
+#include "WorkerPool.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+//png-bench compares PNG decode throughput of the stream, memory, and parallel memory paths,
+// and the time to encode a 4K frame with libpng and with the strip-parallel encoder:
+// usage: png-bench [repeats] [image.png ...]
+// (defaults to 20 repeats of the game's textures in 'dist/')
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	try {
+#endif
+	uint32_t repeats = (argc > 1 ? uint32_t(std::stoul(argv[1])) : 20);
+	std::vector< std::string > filenames;
+	for (int a = 2; a < argc; ++a) {
+		filenames.emplace_back(argv[a]);
+	}
+	if (filenames.empty()) {
+		filenames = { "dist/player_texture.png", "dist/mountain_texture.png", "dist/fire.png" };
+	}
+
+	std::vector< DataBlob > blobs;
+	size_t pixel_bytes = 0; //decoded bytes per pass over all files
+	for (auto const &filename : filenames) {
+		blobs.emplace_back(read_data_file(filename));
+		glm::uvec2 size = peek_png_size(blobs.back().data, blobs.back().size);
+		std::cout << filename << ": " << size.x << "x" << size.y << ", " << blobs.back().size << " bytes" << std::endl;
+		pixel_bytes += size.x * size.y * sizeof(glm::u8vec4);
+	}
+
+	auto report = [&](std::string const &name, std::function< void() > const &pass) {
+		pass(); //warm up
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t r = 0; r < repeats; ++r) {
+			pass();
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration< double >(after - before).count();
+		double images = double(repeats) * double(filenames.size());
+		std::cout << "  " << std::setw(28) << std::left << name
+		          << std::setw(10) << std::right << std::fixed << std::setprecision(3) << (seconds / images * 1000.0) << " ms/image"
+		          << std::setw(10) << std::fixed << std::setprecision(1) << (double(repeats) * double(pixel_bytes) / seconds / (1024.0 * 1024.0)) << " MB/s (decoded)"
+		          << std::endl;
+	};
+
+	std::cout << "Decoding " << filenames.size() << " images x " << repeats << " repeats (" << WorkerPool::shared().size() << " threads in pool):" << std::endl;
+
+	report("istream (ifstream)", [&](){
+		for (auto const &filename : filenames) {
+			std::ifstream file(filename, std::ios::binary);
+			std::vector< glm::u8vec4 > data;
+			unsigned int w, h;
+			if (!load_png(file, &w, &h, &data, LowerLeftOrigin)) {
+				throw std::runtime_error("Failed to decode '" + filename + "'.");
+			}
+		}
+	});
+
+	report("memory", [&](){
+		for (auto const &blob : blobs) {
+			std::vector< glm::u8vec4 > data;
+			glm::uvec2 size;
+			load_png(blob.data, blob.size, &size, &data, LowerLeftOrigin);
+		}
+	});
+
+	//caller-provided storage, allocated once (as a mapped pixel buffer would be):
+	std::vector< std::vector< glm::u8vec4 > > storage;
+	std::vector< PNGDecodeJob > jobs;
+	for (auto const &blob : blobs) {
+		PNGDecodeJob job;
+		job.png_data = blob.data;
+		job.png_size = blob.size;
+		job.size = peek_png_size(blob.data, blob.size);
+		storage.emplace_back(job.size.x * job.size.y);
+		job.pixels = storage.back().data();
+		jobs.emplace_back(job);
+	}
+
+	report("memory, in place", [&](){
+		for (auto const &job : jobs) {
+			decode_png(job, LowerLeftOrigin);
+		}
+	});
+
+	report("memory, in place, parallel", [&](){
+		decode_pngs(jobs, LowerLeftOrigin);
+	});
+
+	{ //encoding a 4K frame:
+		glm::uvec2 size(3840, 2160);
+		std::vector< glm::u8vec4 > frame(size.x * size.y);
+		//something frame-like: smooth gradients with a bit of texture
+		for (uint32_t y = 0; y < size.y; ++y) {
+			for (uint32_t x = 0; x < size.x; ++x) {
+				glm::u8vec4 const &t = storage[0][(y % jobs[0].size.y) * jobs[0].size.x + (x % jobs[0].size.x)];
+				frame[y * size.x + x] = glm::u8vec4((x / 16 + t.x / 4) & 0xff, (y / 9 + t.y / 4) & 0xff, (t.z / 2 + 64) & 0xff, 0xff);
+			}
+		}
+
+		uint32_t encode_repeats = std::max(1U, repeats / 4);
+		std::cout << "Encoding a " << size.x << "x" << size.y << " frame x " << encode_repeats << " repeats:" << std::endl;
+		auto report_encode = [&](std::string const &name, std::function< size_t() > const &encode) {
+			size_t bytes = encode(); //warm up
+			auto before = std::chrono::high_resolution_clock::now();
+			for (uint32_t r = 0; r < encode_repeats; ++r) {
+				bytes = encode();
+			}
+			auto after = std::chrono::high_resolution_clock::now();
+			double seconds = std::chrono::duration< double >(after - before).count();
+			std::cout << "  " << std::setw(28) << std::left << name
+			          << std::setw(10) << std::right << std::fixed << std::setprecision(3) << (seconds / encode_repeats * 1000.0) << " ms/frame"
+			          << std::setw(12) << bytes << " bytes"
+			          << std::endl;
+		};
+
+		report_encode("libpng defaults", [&](){
+			std::ostringstream out;
+			save_png(out, size.x, size.y, frame.data(), LowerLeftOrigin);
+			return out.str().size();
+		});
+		std::vector< char > png;
+		auto encoder = [&](PNGSaveOptions const &options) {
+			return [&png,&size,&frame,options](){
+				encode_png(size, frame.data(), LowerLeftOrigin, options, &png);
+				return png.size();
+			};
+		};
+		PNGSaveOptions serial;
+		serial.parallel = false;
+		report_encode("default options, serial", encoder(serial));
+		report_encode("default options", encoder(PNGSaveOptions()));
+		report_encode("fast()", encoder(PNGSaveOptions::fast()));
+		report_encode("store()", encoder(PNGSaveOptions::store()));
+	}
+
+	return 0;
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
@@ -0,0 +1,139 @@
+#include "sample_codecs.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define CODEC_SSE
+#endif
+
+static constexpr float const Int16Scale = 32767.0f;
+
+static int16_t to_int16(float value) {
+	return int16_t(std::max(-32768L, std::min(32767L, std::lround(value * Int16Scale))));
+}
+
+void encode_int16(float const *src, uint32_t count, std::vector< uint8_t > *out_) {
+	assert(out_);
+	auto &out = *out_;
+	out.resize(size_t(count) * 2);
+	for (uint32_t i = 0; i < count; ++i) {
+		int16_t value = to_int16(src[i]);
+		std::memcpy(out.data() + 2 * i, &value, 2);
+	}
+}
+
+void decode_int16(uint8_t const *data, uint32_t begin, uint32_t count, float *dst) {
+	uint8_t const *src = data + 2 * size_t(begin);
+	uint32_t i = 0;
+#if defined(CODEC_SSE)
+	//eight samples per iteration:
+	__m128 scale = _mm_set1_ps(1.0f / Int16Scale);
+	for (; i + 8 <= count; i += 8) {
+		__m128i s = _mm_loadu_si128(reinterpret_cast< __m128i const * >(src + 2 * i));
+		//sign-extend to 32 bits by moving each value to the top half and shifting back down:
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+#endif
+	//remaining samples (or all of them, for the scalar version):
+	for (; i < count; ++i) {
+		int16_t value;
+		std::memcpy(&value, src + 2 * i, 2);
+		dst[i] = float(value) * (1.0f / Int16Scale);
+	}
+}
+
+//encode one block of (up to) AdpcmBlockSamples samples with a given shift; returns squared error:
+static double encode_adpcm_block(int16_t const *values, uint32_t count, uint8_t shift, uint8_t *block) {
+	std::memset(block, 0, AdpcmBlockBytes);
+	int32_t value = values[0];
+	int16_t start = int16_t(value);
+	std::memcpy(block, &start, 2);
+	block[2] = shift;
+
+	double error = 0.0;
+	for (uint32_t i = 0; i < count; ++i) {
+		//pick the delta that lands closest to the input (closed-loop, so error doesn't accumulate)...
+		int32_t diff = int32_t(values[i]) - value;
+		int32_t delta = (diff >= 0 ? (diff + (1 << shift >> 1)) >> shift : -((-diff + (1 << shift >> 1)) >> shift));
+		delta = std::max(-8, std::min(7, delta));
+		//...without leaving the int16 range (so the decoder never needs to clamp):
+		int32_t step = 1 << shift;
+		while (value + delta * step > 32767) delta -= 1;
+		while (value + delta * step < -32768) delta += 1;
+		value += delta * step;
+		error += double(value - values[i]) * double(value - values[i]);
+		block[4 + i / 2] |= uint8_t((delta & 0xf) << (4 * (i % 2)));
+	}
+	return error;
+}
+
+void encode_adpcm(float const *src, uint32_t count, std::vector< uint8_t > *out_) {
+	assert(out_);
+	auto &out = *out_;
+	uint32_t blocks = (count + AdpcmBlockSamples - 1) / AdpcmBlockSamples;
+	out.assign(size_t(blocks) * AdpcmBlockBytes, 0);
+
+	int16_t values[AdpcmBlockSamples];
+	uint8_t trial[AdpcmBlockBytes];
+	for (uint32_t b = 0; b < blocks; ++b) {
+		uint32_t begin = b * AdpcmBlockSamples;
+		uint32_t length = std::min(AdpcmBlockSamples, count - begin);
+		for (uint32_t i = 0; i < length; ++i) {
+			values[i] = to_int16(src[begin + i]);
+		}
+
+		//try each step size and keep the most accurate (shift 12 can reach any value in a few samples):
+		uint8_t *block = out.data() + size_t(b) * AdpcmBlockBytes;
+		double best = std::numeric_limits< double >::infinity();
+		for (uint8_t shift = 0; shift < 13; ++shift) {
+			double error = encode_adpcm_block(values, length, shift, trial);
+			if (error < best) {
+				best = error;
+				std::memcpy(block, trial, AdpcmBlockBytes);
+			}
+			if (error == 0.0) break;
+		}
+	}
+}
+
+void decode_adpcm(uint8_t const *data, uint32_t begin, uint32_t count, float *dst) {
+	uint32_t end = begin + count;
+	uint32_t i = begin;
+	int32_t steps[AdpcmBlockSamples];
+	while (i < end) {
+		uint32_t b = i / AdpcmBlockSamples;
+		uint8_t const *block = data + size_t(b) * AdpcmBlockBytes;
+		int16_t start;
+		std::memcpy(&start, block, 2);
+		int32_t step = 1 << block[2];
+		uint8_t const *deltas = block + 4;
+
+		//expand the block's signed 4-bit deltas (independent of each other, so this loop vectorizes):
+		for (uint32_t o = 0; o < AdpcmBlockSamples; o += 2) {
+			int32_t lo = deltas[o / 2] & 0xf;
+			int32_t hi = deltas[o / 2] >> 4;
+			steps[o + 0] = ((lo ^ 8) - 8) * step;
+			steps[o + 1] = ((hi ^ 8) - 8) * step;
+		}
+
+		//run up to 'begin' (if starting mid-block), then output:
+		uint32_t first = b * AdpcmBlockSamples;
+		uint32_t last = std::min(first + AdpcmBlockSamples, end);
+		int32_t value = start;
+		for (uint32_t s = first; s < i; ++s) {
+			value += steps[s - first];
+		}
+		for (; i < last; ++i) {
+			value += steps[i - first];
+			dst[i - begin] = float(value) * (1.0f / Int16Scale);
+		}
+	}
+}
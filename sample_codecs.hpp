@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Compact storage for Sound::Sample data (see Sample::Format in Sound.hpp).
+ *
+ * The encoders run when a sample is loaded; the decoders run in the mixer,
+ *  converting a run of samples [begin, begin+count) to floats just before mixing.
+ * Both formats can be decoded starting at any sample, so seeking and looping work as usual.
+ */
+
+//Int16: native-endian signed 16-bit values (32767 == 1.0f); 2 bytes per sample:
+void encode_int16(float const *src, uint32_t count, std::vector< uint8_t > *out);
+void decode_int16(uint8_t const *data, uint32_t begin, uint32_t count, float *dst);
+
+//ADPCM: blocks of AdpcmBlockSamples samples, each stored as a 4-byte header
+// (int16 value before the first sample, uint8 step shift, one unused byte) followed by
+// one signed 4-bit delta per sample (two per byte, low nibble first). The value after each
+// sample is the previous value plus (delta << shift); the encoder makes sure this never
+// leaves the int16 range. About 4.5 bits per sample:
+constexpr uint32_t AdpcmBlockSamples = 64;
+constexpr uint32_t AdpcmBlockBytes = 4 + AdpcmBlockSamples / 2;
+void encode_adpcm(float const *src, uint32_t count, std::vector< uint8_t > *out);
+void decode_adpcm(uint8_t const *data, uint32_t begin, uint32_t count, float *dst);
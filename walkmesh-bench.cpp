@@ -0,0 +1,801 @@
+#include "WalkMesh.hpp"
+#include "WalkPaths.hpp"
+#include "WorkerPool.hpp"
+
+#include <glm/gtx/hash.hpp> //allows the use of 'uvec2' as an unordered_map key
+#include <glm/gtx/quaternion.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+
+//walkmesh-bench times WalkMesh queries on a walkmesh from a '.w' file, and checks that the
+// accelerated versions give exactly the same answers as the simple ones:
+// usage: walkmesh-bench [queries] [walkmesh.w] [name]
+// (defaults to 10000 queries on "WalkMesh" from 'dist/mountain.w')
+//Also casts rays, walks crowds of 10k-100k agents, one at a time and in batches (best of a few runs, with the batch speedup), finds paths between random points,
+// steers agents with flow fields, and compares walking on the mesh as exported with walking on it reordered.
+
+//small deterministic random number generator (so the queries are the same every run):
+struct LCG {
+	uint32_t state;
+	explicit LCG(uint32_t seed) : state(seed) { }
+	float next() { //in [0,1)
+		state = state * 1664525U + 1013904223U;
+		return float(state >> 8) / float(1U << 24);
+	}
+};
+
+//allocator that keeps a count of the bytes it has handed out (for measuring container memory):
+template< typename T >
+struct CountingAllocator {
+	using value_type = T;
+	size_t *bytes;
+	explicit CountingAllocator(size_t *bytes_) : bytes(bytes_) { }
+	template< typename U >
+	CountingAllocator(CountingAllocator< U > const &other) : bytes(other.bytes) { }
+	T *allocate(size_t n) {
+		*bytes += n * sizeof(T);
+		return std::allocator< T >().allocate(n);
+	}
+	void deallocate(T *p, size_t n) {
+		*bytes -= n * sizeof(T);
+		std::allocator< T >().deallocate(p, n);
+	}
+	template< typename U >
+	bool operator==(CountingAllocator< U > const &other) const { return bytes == other.bytes; }
+	template< typename U >
+	bool operator!=(CountingAllocator< U > const &other) const { return bytes != other.bytes; }
+};
+
+//set-associative cache with least-recently-used replacement, for counting the misses a sequence of reads would cause:
+// (a stand-in for hardware counters, which aren't always available; it has no prefetcher, so it shows locality, not speed)
+struct CacheModel {
+	static constexpr uint32_t LineBytes = 64;
+	uint32_t sets, ways;
+	std::vector< uintptr_t > lines; //sets * ways line addresses, most recently used first within each set
+	uint64_t reads = 0, misses = 0;
+	CacheModel(uint32_t bytes, uint32_t ways_) : sets(bytes / LineBytes / ways_), ways(ways_), lines(size_t(sets) * ways, ~uintptr_t(0)) { }
+	void read(void const *address, size_t size) {
+		uintptr_t first = uintptr_t(address) / LineBytes;
+		uintptr_t last = (uintptr_t(address) + size - 1) / LineBytes;
+		for (uintptr_t line = first; line <= last; ++line) {
+			reads += 1;
+			uintptr_t *set = &lines[size_t(line % sets) * ways];
+			uint32_t w = 0;
+			while (w + 1 < ways && set[w] != line) ++w;
+			if (set[w] != line) misses += 1; //(evicts the least recently used line, in the last way)
+			for (; w > 0; --w) set[w] = set[w - 1];
+			set[0] = line;
+		}
+	}
+	template< typename T >
+	void read(T const &value) { read(&value, sizeof(T)); }
+};
+
+//results of timed loops are added here, so the loops can't be optimized away:
+static volatile uint32_t sink = 0;
+
+//do two walkpoints match exactly (same triangle, same bits in the weights)?
+static bool same(WalkPoint const &a, WalkPoint const &b) {
+	return a.indices == b.indices && std::memcmp(&a.weights, &b.weights, sizeof(a.weights)) == 0;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	try {
+#endif
+	uint32_t queries = (argc > 1 ? uint32_t(std::stoul(argv[1])) : 10000);
+	std::string filename = (argc > 2 ? argv[2] : "dist/mountain.w");
+	std::string name = (argc > 3 ? argv[3] : "WalkMesh");
+	if (argc > 4 || queries == 0) {
+		std::cerr << "Usage:\n\t" << argv[0] << " [queries] [walkmesh.w] [name]" << std::endl;
+		return 1;
+	}
+
+	WalkMeshes meshes(filename);
+	WalkMesh const &walkmesh = meshes.lookup(name);
+
+	glm::vec3 min = glm::vec3(std::numeric_limits< float >::infinity());
+	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+	for (auto const &v : walkmesh.vertices) {
+		min = glm::min(min, v);
+		max = glm::max(max, v);
+	}
+	std::cout << "'" << name << "' from '" << filename << "': " << walkmesh.vertices.size() << " vertices, "
+	          << walkmesh.triangles.size() << " triangles, " << walkmesh.bvh.size() << " BVH nodes." << std::endl;
+
+	//query points: scattered over the mesh's bounding box (grown by a quarter on each side),
+	// and along a random walk (like a moving character):
+	LCG rng(0x3a1f);
+	glm::vec3 size = max - min;
+	std::vector< glm::vec3 > scattered(queries);
+	for (auto &pt : scattered) {
+		pt = min - 0.25f * size + 1.5f * glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+	}
+	std::vector< glm::vec3 > path(queries);
+	glm::vec3 at = 0.5f * (min + max);
+	float stride = 0.002f * glm::length(size);
+	for (auto &pt : path) {
+		at += stride * glm::vec3(2.0f * rng.next() - 1.0f, 2.0f * rng.next() - 1.0f, 2.0f * rng.next() - 1.0f);
+		at = glm::min(glm::max(at, min), max);
+		pt = at;
+	}
+
+	auto report = [&](std::string const &label, double seconds, uint32_t count, uint32_t mismatches) {
+		std::cout << "  " << std::setw(30) << std::left << label
+		          << std::setw(10) << std::right << std::fixed << std::setprecision(3) << (seconds * 1e6 / count) << " us/query"
+		          << (mismatches == 0 ? "" : "  (" + std::to_string(mismatches) + " DIFFERENT FROM BRUTE FORCE)")
+		          << std::defaultfloat << std::endl;
+	};
+
+	std::cout << "nearest_walk_point, " << queries << " queries:" << std::endl;
+	for (auto const &[label, points] : { std::make_pair("scattered", &scattered), std::make_pair("path", &path) }) {
+		//brute force (reference answers):
+		std::vector< WalkPoint > reference(points->size());
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < points->size(); ++i) {
+			reference[i] = walkmesh.nearest_walk_point_brute_force((*points)[i]);
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		report(std::string(label) + ", brute force", std::chrono::duration< double >(after - before).count(), queries, 0);
+
+		//BVH, one at a time:
+		std::vector< WalkPoint > results(points->size());
+		before = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < points->size(); ++i) {
+			results[i] = walkmesh.nearest_walk_point((*points)[i]);
+		}
+		after = std::chrono::high_resolution_clock::now();
+		uint32_t mismatches = 0;
+		for (uint32_t i = 0; i < points->size(); ++i) {
+			if (!same(results[i], reference[i])) mismatches += 1;
+		}
+		report(std::string(label) + ", BVH", std::chrono::duration< double >(after - before).count(), queries, mismatches);
+
+		//BVH, batched:
+		before = std::chrono::high_resolution_clock::now();
+		walkmesh.nearest_walk_points(*points, &results);
+		after = std::chrono::high_resolution_clock::now();
+		mismatches = 0;
+		for (uint32_t i = 0; i < points->size(); ++i) {
+			if (!same(results[i], reference[i])) mismatches += 1;
+		}
+		report(std::string(label) + ", BVH batched", std::chrono::duration< double >(after - before).count(), queries, mismatches);
+	}
+
+	{ //casts:
+		enum Kind { Ray, Segment, Drop };
+		struct Casts {
+			std::string label;
+			Kind kind;
+			std::vector< glm::vec3 > origins, directions;
+			std::vector< glm::vec3 > targets; //(for segments)
+			std::vector< float > max_distances;
+		};
+		std::vector< Casts > sets(4);
+		//rays from all over (and around) the mesh, every which way:
+		sets[0].label = "scattered rays";
+		sets[0].kind = Ray;
+		for (uint32_t i = 0; i < queries; ++i) {
+			sets[0].origins.emplace_back(min - 0.25f * size + 1.5f * glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z));
+			sets[0].directions.emplace_back(2.0f * rng.next() - 1.0f, 2.0f * rng.next() - 1.0f, 2.0f * rng.next() - 1.0f);
+		}
+		//rays from a camera above one end of the mesh, looking down across it (a grid of pixels, row by row):
+		sets[1].label = "camera rays";
+		sets[1].kind = Ray;
+		glm::vec3 eye = glm::vec3(min.x - 0.1f * size.x, 0.5f * (min.y + max.y), max.z + 0.2f * size.z);
+		uint32_t width = std::max(1U, uint32_t(std::sqrt(float(queries))));
+		for (uint32_t i = 0; i < queries; ++i) {
+			float x = (float(i % width) + 0.5f) / width;
+			float y = (float(i / width) + 0.5f) / width;
+			sets[1].origins.emplace_back(eye);
+			sets[1].directions.emplace_back(glm::vec3(min.x + y * size.x, min.y + x * size.y, min.z) - eye);
+		}
+		//segments between random points in the mesh's bounds (like line-of-sight checks):
+		sets[2].label = "segments";
+		sets[2].kind = Segment;
+		for (uint32_t i = 0; i < queries; ++i) {
+			glm::vec3 from = min + glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+			glm::vec3 to = min + glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+			sets[2].origins.emplace_back(from);
+			sets[2].targets.emplace_back(to);
+			sets[2].directions.emplace_back(to - from);
+			sets[2].max_distances.emplace_back(glm::length(to - from));
+		}
+		//straight down from above the mesh:
+		sets[3].label = "drops";
+		sets[3].kind = Drop;
+		for (uint32_t i = 0; i < queries; ++i) {
+			sets[3].origins.emplace_back(min.x + rng.next() * size.x, min.y + rng.next() * size.y, max.z + 1.0f);
+			sets[3].directions.emplace_back(0.0f, 0.0f, -1.0f);
+		}
+		for (auto &set : sets) {
+			set.max_distances.resize(queries, std::numeric_limits< float >::infinity());
+		}
+
+		std::cout << "casts, " << queries << " of each kind:" << std::endl;
+		for (auto const &set : sets) {
+			//brute force (reference answers):
+			std::vector< WalkPoint > reference(queries);
+			std::vector< float > reference_distances(queries, std::numeric_limits< float >::infinity());
+			uint32_t hit_count = 0;
+			auto before = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < queries; ++i) {
+				if (walkmesh.ray_cast_brute_force(set.origins[i], set.directions[i], &reference[i], &reference_distances[i], set.max_distances[i])) hit_count += 1;
+			}
+			auto after = std::chrono::high_resolution_clock::now();
+			std::cout << "  " << set.label << " (" << hit_count << " hit):" << std::endl;
+			report("  brute force", std::chrono::duration< double >(after - before).count(), queries, 0);
+
+			auto mismatches = [&](std::vector< WalkPoint > const &hits, std::vector< float > const &distances) {
+				uint32_t count = 0;
+				for (uint32_t i = 0; i < queries; ++i) {
+					if (hits[i].triangle != reference[i].triangle
+					 || std::memcmp(&distances[i], &reference_distances[i], sizeof(float)) != 0
+					 || (hits[i].triangle != -1U && !same(hits[i], reference[i]))) count += 1;
+				}
+				return count;
+			};
+
+			//BVH, one at a time:
+			std::vector< WalkPoint > hits(queries);
+			std::vector< float > distances(queries, std::numeric_limits< float >::infinity());
+			before = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < queries; ++i) {
+				if (set.kind == Segment) walkmesh.segment_cast(set.origins[i], set.targets[i], &hits[i], &distances[i]);
+				else if (set.kind == Drop) walkmesh.drop_cast(set.origins[i], &hits[i], &distances[i]);
+				else walkmesh.ray_cast(set.origins[i], set.directions[i], &hits[i], &distances[i]);
+			}
+			after = std::chrono::high_resolution_clock::now();
+			report(std::string("  ") + (set.kind == Segment ? "segment_cast" : (set.kind == Drop ? "drop_cast" : "ray_cast")), std::chrono::duration< double >(after - before).count(), queries, mismatches(hits, distances));
+
+			//BVH, batched:
+			before = std::chrono::high_resolution_clock::now();
+			walkmesh.ray_casts(queries, set.origins.data(), set.directions.data(), set.max_distances.data(), hits.data(), distances.data());
+			after = std::chrono::high_resolution_clock::now();
+			report("  ray_casts", std::chrono::duration< double >(after - before).count(), queries, mismatches(hits, distances));
+		}
+	}
+
+	{ //crossing edges: the half-edge table vs. the (a,b)->c hash map it replaced:
+		size_t map_bytes = 0;
+		using NextVertex = std::unordered_map< glm::uvec2, uint32_t, std::hash< glm::uvec2 >, std::equal_to< glm::uvec2 >, CountingAllocator< std::pair< glm::uvec2 const, uint32_t > > >;
+		NextVertex next_vertex(0, std::hash< glm::uvec2 >(), std::equal_to< glm::uvec2 >(), CountingAllocator< std::pair< glm::uvec2 const, uint32_t > >(&map_bytes));
+		next_vertex.reserve(walkmesh.triangles.size() * 3);
+		for (auto const &tri : walkmesh.triangles) {
+			next_vertex.emplace(glm::uvec2(tri.x, tri.y), tri.z);
+			next_vertex.emplace(glm::uvec2(tri.y, tri.z), tri.x);
+			next_vertex.emplace(glm::uvec2(tri.z, tri.x), tri.y);
+		}
+		size_t table_bytes = sizeof(uint32_t) * (walkmesh.opposite.size() + walkmesh.vertex_edges.size() + walkmesh.vertex_edges_begin.size());
+
+		//a point on every interior edge, in a scrambled order:
+		std::vector< WalkPoint > on_edges;
+		for (uint32_t h = 0; h < walkmesh.opposite.size(); ++h) {
+			if (walkmesh.opposite[h] == -1U) continue;
+			glm::uvec3 const &tri = walkmesh.triangles[h / 3];
+			uint32_t e = h % 3;
+			on_edges.emplace_back(glm::uvec3(tri[e], tri[(e + 1) % 3], tri[(e + 2) % 3]), glm::vec3(0.5f, 0.5f, 0.0f), h / 3);
+		}
+		for (uint32_t i = uint32_t(on_edges.size()); i > 1; --i) {
+			std::swap(on_edges[i - 1], on_edges[std::min(i - 1, uint32_t(rng.next() * i))]);
+		}
+		uint32_t repeats = std::max(1U, queries * 10 / uint32_t(on_edges.size()));
+		uint32_t crossings = repeats * uint32_t(on_edges.size());
+
+		auto time_crossings = [&](std::string const &label, auto &&cross) {
+			uint32_t check = 0;
+			auto before = std::chrono::high_resolution_clock::now();
+			for (uint32_t r = 0; r < repeats; ++r) {
+				for (auto const &wp : on_edges) {
+					check += cross(wp);
+				}
+			}
+			auto after = std::chrono::high_resolution_clock::now();
+			std::cout << "  " << std::setw(30) << std::left << label
+			          << std::setw(10) << std::right << std::fixed << std::setprecision(2) << (std::chrono::duration< double >(after - before).count() * 1e9 / crossings) << " ns/crossing"
+			          << std::defaultfloat << std::endl;
+			sink = sink + check;
+		};
+
+		std::cout << "cross_edge, " << crossings << " crossings of " << on_edges.size() << " interior edges:" << std::endl;
+		std::cout << "  adjacency memory: " << std::fixed << std::setprecision(1)
+		          << (double(map_bytes) / walkmesh.triangles.size()) << " bytes/triangle as a hash map, "
+		          << (double(table_bytes) / walkmesh.triangles.size()) << " as half-edge tables" << std::defaultfloat << std::endl;
+		time_crossings("hash map lookup", [&](WalkPoint const &wp) {
+			return next_vertex.find(glm::uvec2(wp.indices.y, wp.indices.x))->second;
+		});
+		time_crossings("half-edge table lookup", [&](WalkPoint const &wp) {
+			uint32_t o = walkmesh.opposite[walkmesh.find_half_edge(wp)];
+			return walkmesh.triangles[o / 3][(o % 3 + 2) % 3];
+		});
+		time_crossings("cross_edge", [&](WalkPoint const &wp) {
+			WalkPoint end;
+			glm::quat rotation;
+			walkmesh.cross_edge(wp, &end, &rotation);
+			return end.indices.z;
+		});
+		time_crossings("cross_edge, triangle unknown", [&](WalkPoint const &wp) {
+			WalkPoint end;
+			glm::quat rotation;
+			walkmesh.cross_edge(WalkPoint(wp.indices, wp.weights), &end, &rotation);
+			return end.indices.z;
+		});
+	}
+
+	//crowds: agents wander at the player's speed (15 units/second, 60 frames/second), turning a little each frame:
+	constexpr uint32_t Frames = 10;
+	constexpr float AgentStep = 15.0f / 60.0f;
+	std::cout << "walking crowds for " << Frames << " frames:" << std::endl;
+	for (uint32_t agents : {10000U, 30000U, 100000U}) {
+		std::vector< glm::vec3 > starts(agents);
+		for (auto &pt : starts) {
+			pt = min + glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+		}
+		std::vector< WalkPoint > start_at;
+		walkmesh.nearest_walk_points(starts, &start_at);
+		std::vector< uint32_t > iterations(agents, 10);
+
+		//steps for each frame (the same for every run):
+		std::vector< std::vector< glm::vec3 > > frame_steps(Frames, std::vector< glm::vec3 >(agents));
+		std::vector< float > heading(agents);
+		for (auto &h : heading) h = 6.2831853f * rng.next();
+		for (auto &steps : frame_steps) {
+			for (uint32_t i = 0; i < agents; ++i) {
+				heading[i] += 0.5f * (rng.next() - 0.5f);
+				steps[i] = AgentStep * glm::vec3(std::cos(heading[i]), std::sin(heading[i]), 0.0f);
+			}
+		}
+
+		//(the frames are walked a few times from the start, keeping the fastest, since a single pass is short enough for noise to swamp the differences)
+		constexpr uint32_t Repeats = 5;
+		auto run = [&](std::string const &label, auto &&walk_frame, std::vector< WalkPoint > *at_) {
+			auto &at = *at_;
+			std::vector< glm::vec3 > steps;
+			double seconds = std::numeric_limits< double >::infinity();
+			for (uint32_t r = 0; r < Repeats; ++r) {
+				at = start_at;
+				double total = 0.0;
+				for (uint32_t f = 0; f < Frames; ++f) {
+					steps = frame_steps[f];
+					auto before = std::chrono::high_resolution_clock::now();
+					walk_frame(&at, &steps);
+					auto after = std::chrono::high_resolution_clock::now();
+					total += std::chrono::duration< double >(after - before).count();
+				}
+				seconds = std::min(seconds, total);
+			}
+			double agent_steps = double(agents) * Frames;
+			std::cout << "  " << std::setw(40) << std::left << (std::to_string(agents) + " agents, " + label)
+			          << std::setw(10) << std::right << std::fixed << std::setprecision(2) << (seconds * 1e9 / agent_steps) << " ns/agent/frame"
+			          << std::setw(9) << std::setprecision(1) << (agent_steps / seconds * 1e-6) << "M agent-steps/s"
+			          << std::setw(9) << std::setprecision(3) << (seconds * 1e3 / Frames) << " ms/frame"
+			          << std::defaultfloat;
+			return seconds;
+		};
+
+		std::vector< WalkPoint > reference;
+		double one_at_a_time = run("walk", [&](std::vector< WalkPoint > *at, std::vector< glm::vec3 > *steps) {
+			for (uint32_t i = 0; i < agents; ++i) {
+				(*steps)[i] = walkmesh.walk(&(*at)[i], (*steps)[i], iterations[i]);
+			}
+		}, &reference);
+		std::cout << std::endl;
+
+		std::vector< WalkPoint > results;
+		double batched = run("walk_batch", [&](std::vector< WalkPoint > *at, std::vector< glm::vec3 > *steps) {
+			walkmesh.walk_batch(agents, at->data(), steps->data(), iterations.data());
+		}, &results);
+		std::cout << std::fixed << std::setprecision(2) << std::setw(7) << (one_at_a_time / batched) << "x" << std::defaultfloat;
+		uint32_t mismatches = 0;
+		for (uint32_t i = 0; i < agents; ++i) {
+			if (!same(results[i], reference[i]) || results[i].triangle != reference[i].triangle) mismatches += 1;
+		}
+		std::cout << (mismatches == 0 ? "" : "  (" + std::to_string(mismatches) + " agents DIFFERENT FROM walk)") << std::endl;
+
+		if (agents != 100000U) continue;
+
+		//on more threads (results should match walk exactly, whatever the thread count):
+		std::vector< uint32_t > thread_counts;
+		uint32_t hardware = std::max(1U, std::thread::hardware_concurrency());
+		for (uint32_t t = 1; t < std::max(2U, hardware); t *= 2) thread_counts.emplace_back(t);
+		thread_counts.emplace_back(std::max(2U, hardware));
+		double one_thread = 0.0;
+		for (uint32_t threads : thread_counts) {
+			WorkerPool pool(threads);
+			double seconds = run("walk_parallel, " + std::to_string(threads) + (threads == 1 ? " thread" : " threads"), [&](std::vector< WalkPoint > *at, std::vector< glm::vec3 > *steps) {
+				walkmesh.walk_parallel(pool, agents, at->data(), steps->data(), iterations.data());
+			}, &results);
+			if (threads == 1) one_thread = seconds;
+			mismatches = 0;
+			for (uint32_t i = 0; i < agents; ++i) {
+				if (!same(results[i], reference[i]) || results[i].triangle != reference[i].triangle) mismatches += 1;
+			}
+			std::cout << std::fixed << std::setprecision(2) << std::setw(7) << (one_thread / seconds) << "x" << std::defaultfloat
+			          << (threads > hardware ? " (more threads than cores)" : "")
+			          << (mismatches == 0 ? "" : "  (" + std::to_string(mismatches) + " agents DIFFERENT FROM walk)") << std::endl;
+		}
+	}
+
+	{ //walking with and without the per-triangle cache (WalkMesh::triangle_data):
+		WalkMesh uncached(walkmesh.vertices, walkmesh.normals, walkmesh.triangles, false);
+		size_t bytes = sizeof(WalkMesh::TriangleData) * walkmesh.triangle_data.size();
+		std::cout << "triangle_data: " << bytes << " bytes (" << sizeof(WalkMesh::TriangleData) << " per triangle)" << std::endl;
+
+		constexpr uint32_t Agents = 30000;
+		std::vector< glm::vec3 > starts(Agents);
+		for (auto &pt : starts) {
+			pt = min + glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+		}
+		std::vector< WalkPoint > start_at;
+		walkmesh.nearest_walk_points(starts, &start_at);
+		std::vector< std::vector< glm::vec3 > > frame_steps(Frames, std::vector< glm::vec3 >(Agents));
+		for (auto &steps : frame_steps) {
+			for (auto &step : steps) {
+				float heading = 6.2831853f * rng.next();
+				step = AgentStep * glm::vec3(std::cos(heading), std::sin(heading), 0.0f);
+			}
+		}
+		std::vector< uint32_t > iterations(Agents, 10);
+
+		//time one kind of walking on both meshes:
+		auto compare = [&](std::string const &label, auto &&walk_frame) {
+			double seconds[2];
+			std::vector< WalkPoint > ends[2];
+			for (uint32_t m = 0; m < 2; ++m) {
+				WalkMesh const &mesh = (m == 0 ? uncached : walkmesh);
+				ends[m] = start_at;
+				seconds[m] = 0.0;
+				for (uint32_t f = 0; f < Frames; ++f) {
+					std::vector< glm::vec3 > steps = frame_steps[f];
+					auto before = std::chrono::high_resolution_clock::now();
+					walk_frame(mesh, &ends[m], &steps);
+					auto after = std::chrono::high_resolution_clock::now();
+					seconds[m] += std::chrono::duration< double >(after - before).count();
+				}
+			}
+			//(the two don't round the same way, so agents may end up slightly apart)
+			float apart = 0.0f;
+			for (uint32_t i = 0; i < Agents; ++i) {
+				apart = std::max(apart, glm::length(walkmesh.to_world_point(ends[0][i]) - walkmesh.to_world_point(ends[1][i])));
+			}
+			double agent_steps = double(Agents) * Frames;
+			std::cout << "  " << std::setw(30) << std::left << label << std::right << std::fixed << std::setprecision(2)
+			          << std::setw(8) << (seconds[0] * 1e9 / agent_steps) << " -> " << std::setw(7) << (seconds[1] * 1e9 / agent_steps) << " ns/agent/frame"
+			          << std::setw(7) << (seconds[0] / seconds[1]) << "x  (agents end at most " << std::setprecision(6) << apart << " apart)"
+			          << std::defaultfloat << std::endl;
+		};
+		std::cout << "walking " << Agents << " agents for " << Frames << " frames, without -> with triangle_data:" << std::endl;
+		compare("walk_in_triangle", [&](WalkMesh const &mesh, std::vector< WalkPoint > *at, std::vector< glm::vec3 > *steps) {
+			for (uint32_t i = 0; i < Agents; ++i) {
+				WalkPoint end;
+				float time;
+				mesh.walk_in_triangle((*at)[i], (*steps)[i], &end, &time);
+				(*at)[i] = end;
+			}
+		});
+		compare("walk", [&](WalkMesh const &mesh, std::vector< WalkPoint > *at, std::vector< glm::vec3 > *steps) {
+			for (uint32_t i = 0; i < Agents; ++i) {
+				mesh.walk(&(*at)[i], (*steps)[i], iterations[i]);
+			}
+		});
+		compare("walk_batch", [&](WalkMesh const &mesh, std::vector< WalkPoint > *at, std::vector< glm::vec3 > *steps) {
+			mesh.walk_batch(Agents, at->data(), steps->data(), iterations.data());
+		});
+	}
+
+	{ //paths between random points on the mesh:
+		uint32_t pairs = std::max(1U, queries / 10);
+		std::vector< glm::vec3 > ends(2 * pairs);
+		for (auto &pt : ends) {
+			pt = min + glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+		}
+		std::vector< WalkPoint > ends_at;
+		walkmesh.nearest_walk_points(ends, &ends_at);
+
+		WalkPaths paths(walkmesh, 2 * pairs);
+		std::vector< WalkPath > reference(pairs);
+
+		auto time_paths = [&](std::string const &label, auto &&find_all) {
+			auto before = std::chrono::high_resolution_clock::now();
+			find_all();
+			auto after = std::chrono::high_resolution_clock::now();
+			std::cout << "  " << std::setw(30) << std::left << label
+			          << std::setw(10) << std::right << std::fixed << std::setprecision(3) << (std::chrono::duration< double >(after - before).count() * 1e6 / pairs) << " us/query"
+			          << std::defaultfloat;
+		};
+
+		std::cout << "WalkPaths::find, " << pairs << " queries:" << std::endl;
+		uint32_t found = 0;
+		time_paths("uncached", [&]() {
+			for (uint32_t i = 0; i < pairs; ++i) {
+				if (paths.find(ends_at[2 * i], ends_at[2 * i + 1], &reference[i])) found += 1;
+			}
+		});
+		uint64_t expanded = 0;
+		uint32_t most_expanded = 0;
+		uint64_t points = 0;
+		uint32_t bad = 0; //paths with consecutive points that don't share a triangle or are in the same place, or shorter than a straight line
+		for (uint32_t i = 0; i < pairs; ++i) {
+			WalkPath const &p = reference[i];
+			if (p.points.empty()) continue;
+			expanded += p.expanded;
+			most_expanded = std::max(most_expanded, p.expanded);
+			points += p.points.size();
+			float straight = glm::length(walkmesh.to_world_point(ends_at[2 * i + 1]) - walkmesh.to_world_point(ends_at[2 * i]));
+			bool ok = (p.length >= straight * 0.9999f);
+			for (uint32_t j = 1; j < p.points.size(); ++j) {
+				//no zero-length segments (unless the start and goal are in the same place):
+				if (p.points.size() > 2 && walkmesh.to_world_point(p.points[j-1]) == walkmesh.to_world_point(p.points[j])) ok = false;
+				//vertices the two points are on (those with nonzero weight) must all be in one of the triangles around the first:
+				std::vector< uint32_t > on;
+				for (WalkPoint const *wp : {&p.points[j-1], &p.points[j]}) {
+					for (uint32_t k = 0; k < 3; ++k) {
+						if (wp->weights[k] != 0.0f) on.emplace_back(wp->indices[k]);
+					}
+				}
+				bool shared = false;
+				for (uint32_t e = walkmesh.vertex_edges_begin[on[0]]; e < walkmesh.vertex_edges_begin[on[0] + 1]; ++e) {
+					glm::uvec3 const &tri = walkmesh.triangles[walkmesh.vertex_edges[e] / 3];
+					bool all = true;
+					for (uint32_t v : on) {
+						if (tri.x != v && tri.y != v && tri.z != v) all = false;
+					}
+					if (all) shared = true;
+				}
+				if (!shared) ok = false;
+			}
+			if (!ok) bad += 1;
+		}
+		std::cout << "  (" << found << " found, " << std::fixed << std::setprecision(1) << (double(expanded) / std::max(1U, found)) << " triangles expanded on average, "
+		          << most_expanded << " at most, " << (double(points) / std::max(1U, found)) << " points per path" << std::defaultfloat
+		          << (bad == 0 ? "" : ", " + std::to_string(bad) + " BAD PATHS") << ")" << std::endl;
+
+		std::vector< WalkPath > results(pairs);
+		auto check = [&]() {
+			uint32_t mismatches = 0;
+			for (uint32_t i = 0; i < pairs; ++i) {
+				bool match = results[i].points.size() == reference[i].points.size() && results[i].triangles == reference[i].triangles;
+				for (uint32_t j = 0; match && j < results[i].points.size(); ++j) {
+					if (!same(results[i].points[j], reference[i].points[j])) match = false;
+				}
+				if (!match) mismatches += 1;
+			}
+			std::cout << (mismatches == 0 ? "" : "  (" + std::to_string(mismatches) + " paths DIFFERENT FROM uncached)") << std::endl;
+		};
+		time_paths("cached", [&]() {
+			for (uint32_t i = 0; i < pairs; ++i) {
+				paths.find(ends_at[2 * i], ends_at[2 * i + 1], &results[i]);
+			}
+		});
+		check();
+
+		//from several threads at once (on a fresh cache):
+		uint32_t threads = std::max(2U, std::thread::hardware_concurrency());
+		WorkerPool pool(threads);
+		paths.clear_cache();
+		time_paths("uncached, " + std::to_string(threads) + " threads", [&]() {
+			pool.run(pairs, [&](uint32_t i) {
+				paths.find(ends_at[2 * i], ends_at[2 * i + 1], &results[i]);
+			});
+		});
+		check();
+	}
+
+	{ //flow fields: agents heading for the nearest of a few goals:
+		constexpr uint32_t Goals = 4;
+		std::vector< glm::vec3 > goal_points(Goals + 1);
+		for (auto &pt : goal_points) {
+			pt = min + glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+		}
+		std::vector< WalkPoint > goal_at;
+		walkmesh.nearest_walk_points(goal_points, &goal_at);
+		std::vector< WalkPoint > goals(goal_at.begin(), goal_at.begin() + Goals);
+		//the same goals with the first one moved:
+		std::vector< WalkPoint > moved(goal_at.begin() + 1, goal_at.end());
+
+		FlowFields flows(walkmesh);
+		auto time_field = [&](std::string const &label, std::vector< WalkPoint > const &set) -> FlowField const & {
+			auto before = std::chrono::high_resolution_clock::now();
+			FlowField const &field = flows.field(set);
+			auto after = std::chrono::high_resolution_clock::now();
+			std::cout << "  " << std::setw(30) << std::left << label
+			          << std::setw(10) << std::right << std::fixed << std::setprecision(3) << (std::chrono::duration< double >(after - before).count() * 1e6) << " us"
+			          << "  (" << field.touched << " triangles settled)" << std::defaultfloat << std::endl;
+			return field;
+		};
+		std::cout << "FlowFields::field, " << Goals << " goals:" << std::endl;
+		time_field("build", goals);
+		time_field("cached", goals);
+		FlowField const &field = time_field("one goal moved (incremental)", moved);
+
+		//incremental update should give the same distances as building from scratch:
+		FlowField scratch;
+		flows.update(&scratch, moved);
+		uint32_t mismatches = 0;
+		for (uint32_t t = 0; t < walkmesh.triangles.size(); ++t) {
+			if (std::memcmp(&scratch.distances[t], &field.distances[t], sizeof(float)) != 0) mismatches += 1;
+		}
+		if (mismatches != 0) std::cout << "  (" << mismatches << " triangles DIFFERENT FROM a fresh build)" << std::endl;
+
+		//agents follow the field, one lookup per step:
+		constexpr uint32_t Agents = 10000;
+		std::vector< glm::vec3 > starts(Agents);
+		for (auto &pt : starts) {
+			pt = min + glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+		}
+		std::vector< WalkPoint > agents;
+		walkmesh.nearest_walk_points(starts, &agents);
+		auto average_distance = [&]() {
+			double total = 0.0;
+			for (auto const &at : agents) total += field.distances[at.triangle];
+			return total / Agents;
+		};
+		double distance_before = average_distance();
+		double lookup_seconds = 0.0, walk_seconds = 0.0;
+		std::vector< glm::vec3 > steps(Agents);
+		for (uint32_t f = 0; f < Frames; ++f) {
+			auto before = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < Agents; ++i) {
+				steps[i] = AgentStep * field.direction(walkmesh, agents[i]);
+			}
+			auto middle = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < Agents; ++i) {
+				walkmesh.walk(&agents[i], steps[i]);
+			}
+			auto after = std::chrono::high_resolution_clock::now();
+			lookup_seconds += std::chrono::duration< double >(middle - before).count();
+			walk_seconds += std::chrono::duration< double >(after - middle).count();
+		}
+		std::cout << "  " << Agents << " agents for " << Frames << " frames: " << std::fixed << std::setprecision(2)
+		          << (lookup_seconds * 1e9 / (double(Agents) * Frames)) << " ns/agent/frame looking up, "
+		          << (walk_seconds * 1e9 / (double(Agents) * Frames)) << " walking; average distance to goal "
+		          << distance_before << " -> " << average_distance() << std::defaultfloat << std::endl;
+	}
+
+	{ //walking on the mesh as exported and as reordered by WalkMeshes (triangles in Z-order, vertices in order of use):
+		WalkMeshes reordered_meshes(filename, true);
+		WalkMesh const &reordered = reordered_meshes.lookup(name);
+
+		constexpr uint32_t Agents = 30000;
+		std::vector< glm::vec3 > starts(Agents);
+		for (auto &pt : starts) {
+			pt = min + glm::vec3(rng.next() * size.x, rng.next() * size.y, rng.next() * size.z);
+		}
+		std::vector< std::vector< glm::vec3 > > frame_steps(Frames, std::vector< glm::vec3 >(Agents));
+		for (auto &steps : frame_steps) {
+			for (auto &step : steps) {
+				float heading = 6.2831853f * rng.next();
+				step = AgentStep * glm::vec3(std::cos(heading), std::sin(heading), 0.0f);
+			}
+		}
+
+		//the same start points on both meshes (starts on edges would otherwise often be put on a different triangle of the
+		// reordered mesh, since nearest_walk_points breaks ties by triangle number):
+		std::vector< WalkPoint > start_at[2];
+		walkmesh.nearest_walk_points(starts, &start_at[0]);
+		std::unordered_map< glm::vec3, uint32_t > reordered_vertex;
+		for (uint32_t v = 0; v < reordered.vertices.size(); ++v) {
+			reordered_vertex.emplace(reordered.vertices[v], v);
+		}
+		for (WalkPoint const &wp : start_at[0]) {
+			WalkPoint mapped(glm::uvec3(-1U), wp.weights);
+			for (uint32_t c = 0; c < 3; ++c) {
+				auto f = reordered_vertex.find(walkmesh.vertices[wp.indices[c]]);
+				if (f != reordered_vertex.end()) mapped.indices[c] = f->second;
+			}
+			uint32_t h = (mapped.indices != glm::uvec3(-1U) ? reordered.find_half_edge(mapped) : -1U);
+			if (h != -1U) mapped.triangle = h / 3;
+			else mapped = reordered.nearest_walk_point(walkmesh.to_world_point(wp)); //(vertices in the same place)
+			start_at[1].emplace_back(mapped);
+		}
+
+		std::cout << "walking " << Agents << " agents for " << Frames << " frames, mesh as exported -> reordered:" << std::endl;
+		std::cout << "  (misses are from a model of a 32 KiB 8-way L1 and a 1 MiB 16-way L2 cache, per walk iteration)" << std::endl;
+		for (bool sorted : {false, true}) {
+			double seconds[2];
+			double l1_misses[2], l2_misses[2];
+			std::vector< glm::vec3 > ends[2];
+			for (uint32_t m = 0; m < 2; ++m) {
+				WalkMesh const &mesh = (m == 0 ? walkmesh : reordered);
+				//agents in the order they were spawned, or sorted by the triangle they start on:
+				// (their arrays are rearranged to match, so agents are always walked in the order they are stored)
+				std::vector< uint32_t > agent(Agents);
+				for (uint32_t i = 0; i < Agents; ++i) agent[i] = i;
+				if (sorted) std::stable_sort(agent.begin(), agent.end(), [&](uint32_t a, uint32_t b) { return start_at[m][a].triangle < start_at[m][b].triangle; });
+				std::vector< WalkPoint > at(Agents);
+				std::vector< std::vector< glm::vec3 > > steps(Frames, std::vector< glm::vec3 >(Agents));
+				for (uint32_t i = 0; i < Agents; ++i) {
+					at[i] = start_at[m][agent[i]];
+					for (uint32_t f = 0; f < Frames; ++f) steps[f][i] = frame_steps[f][agent[i]];
+				}
+
+				//timed:
+				std::vector< WalkPoint > timed = at;
+				seconds[m] = 0.0;
+				for (uint32_t f = 0; f < Frames; ++f) {
+					auto before = std::chrono::high_resolution_clock::now();
+					for (uint32_t i = 0; i < Agents; ++i) {
+						mesh.walk(&timed[i], steps[f][i]);
+					}
+					auto after = std::chrono::high_resolution_clock::now();
+					seconds[m] += std::chrono::duration< double >(after - before).count();
+				}
+
+				//traced, one walk iteration at a time, reading what walk reads from the mesh:
+				CacheModel l1(32 * 1024, 8), l2(1024 * 1024, 16);
+				auto read = [&](auto const &value) {
+					uint64_t misses = l1.misses;
+					l1.read(value);
+					if (l1.misses != misses) l2.read(value);
+				};
+				uint64_t iterations = 0;
+				for (uint32_t f = 0; f < Frames; ++f) {
+					for (uint32_t i = 0; i < Agents; ++i) {
+						glm::vec3 remain = steps[f][i];
+						for (uint32_t iter = 0; iter < 10 && remain != glm::vec3(0.0f); ++iter) {
+							uint32_t t = at[i].triangle;
+							remain = mesh.walk(&at[i], remain, 1);
+							iterations += 1;
+							read(mesh.triangles[t]);
+							if (!mesh.triangle_data.empty()) read(mesh.triangle_data[t]);
+							if (remain == glm::vec3(0.0f)) continue;
+							//reached an edge: looked for its neighbour, and maybe crossed:
+							read(mesh.opposite[3 * t]);
+							if (at[i].triangle != t) {
+								read(mesh.triangles[at[i].triangle]);
+								read(mesh.normals[at[i].indices.x]);
+								read(mesh.normals[at[i].indices.y]);
+							}
+						}
+						//the agent's position is read back to draw it:
+						read(mesh.vertices[at[i].indices.x]);
+						read(mesh.vertices[at[i].indices.y]);
+						read(mesh.vertices[at[i].indices.z]);
+					}
+				}
+				l1_misses[m] = double(l1.misses) / iterations;
+				l2_misses[m] = double(l2.misses) / iterations;
+
+				uint32_t mismatches = 0;
+				ends[m].resize(Agents);
+				for (uint32_t i = 0; i < Agents; ++i) {
+					if (!same(timed[i], at[i])) mismatches += 1;
+					ends[m][agent[i]] = mesh.to_world_point(at[i]);
+				}
+				if (mismatches != 0) std::cout << "  (" << mismatches << " agents traced DIFFERENTLY FROM walk)" << std::endl;
+			}
+			//(walking does the same arithmetic on the same triangles, so agents should end up in exactly the same places)
+			uint32_t mismatches = 0;
+			for (uint32_t i = 0; i < Agents; ++i) {
+				if (std::memcmp(&ends[0][i], &ends[1][i], sizeof(glm::vec3)) != 0) mismatches += 1;
+			}
+			double agent_steps = double(Agents) * Frames;
+			std::cout << "  " << std::setw(30) << std::left << (sorted ? "agents sorted by triangle" : "agents in spawn order") << std::right << std::fixed << std::setprecision(2)
+			          << std::setw(8) << (seconds[0] * 1e9 / agent_steps) << " -> " << std::setw(7) << (seconds[1] * 1e9 / agent_steps) << " ns/agent/frame"
+			          << std::setw(7) << (seconds[0] / seconds[1]) << "x" << std::setprecision(3)
+			          << "  L1 misses " << l1_misses[0] << " -> " << l1_misses[1]
+			          << ", L2 misses " << l2_misses[0] << " -> " << l2_misses[1]
+			          << std::defaultfloat << (mismatches == 0 ? "" : "  (" + std::to_string(mismatches) + " agents END ELSEWHERE)") << std::endl;
+		}
+	}
+
+	return 0;
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}